@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "Common.h"
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+// Smallest block we ask the system for, one huge page
+constexpr size_t ARENA_BLOCK_SIZE = HUGE_PAGE_SIZE;
+// Everything in the arena starts on its own cache line unless asked otherwise
+constexpr size_t ARENA_ALIGNMENT = 64;
+
+namespace ARENA_BACKING {
+    enum ARENA_BACKING : uint8_t {
+        // Regular pages from the heap
+        PAGES = 0,
+        // Regular pages the kernel may back with transparent huge pages ( madvise )
+        TRANSPARENT_HUGE_PAGES,
+        // Reserved huge pages ( MAP_HUGETLB or MEM_LARGE_PAGES )
+        HUGE_PAGES
+    };
+}
+
+typedef struct {
+    uint8_t* memory;
+    size_t size;
+    size_t used;
+    ARENA_BACKING::ARENA_BACKING backing;
+} t_arena_block;
+
+// One allocation, only kept for the memory map
+typedef struct {
+    const char* name;
+    uint32_t block;
+    size_t offset;
+    size_t size;
+} t_arena_region;
+
+/// <summary>
+///  Bump allocator for everything the search reads while it runs: the candidate tables, the boards and the search
+///  stacks. Nothing is freed on its own, the whole arena goes away at the end of the solve. There is no locking,
+///  only one thread may allocate at a time: the setup, and once the search runs the candidate order thread ( see
+///  CandidateOrder.h ) which is the only one left allocating. The memory map has to be printed before it starts.
+/// </summary>
+typedef struct {
+    bool huge_pages;
+    std::vector<t_arena_block> blocks;
+    std::vector<t_arena_region> regions;
+} t_arena;
+
+INLINE
+const char* arena_backing_name(ARENA_BACKING::ARENA_BACKING backing) {
+    switch (backing) {
+    case ARENA_BACKING::TRANSPARENT_HUGE_PAGES:
+        return "transparent huge pages";
+    case ARENA_BACKING::HUGE_PAGES:
+        return "huge pages";
+    default:
+        return "pages";
+    }
+}
+
+/// <summary>
+///  Get a block of at least 'size' bytes from the system. With huge pages we try the reserved ones first and fall
+///  back to regular pages the kernel is asked to merge, when even that is not possible we get plain pages.
+/// </summary>
+INLINE
+bool arena_map_block(t_arena_block& block, size_t size, bool huge_pages) {
+    block.used = 0;
+    if (huge_pages) {
+        block.size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#if defined(_MSC_VER)
+        // Needs the 'Lock pages in memory' privilege, without it the call fails and we use regular pages
+        const auto large_page_size = std::max<size_t>(GetLargePageMinimum(), 1);
+        const auto large_size = (size + large_page_size - 1) / large_page_size * large_page_size;
+        block.memory = static_cast<uint8_t*>(VirtualAlloc(nullptr, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+        if (block.memory != nullptr) {
+            block.size = large_size;
+            block.backing = ARENA_BACKING::HUGE_PAGES;
+            return true;
+        }
+#elif defined(__linux__)
+        auto memory = mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            block.memory = static_cast<uint8_t*>(memory);
+            block.backing = ARENA_BACKING::HUGE_PAGES;
+            return true;
+        }
+        // No reserved huge pages, aligned regular pages can still be merged by the kernel
+        block.memory = static_cast<uint8_t*>(alloc_aligned(block.size, HUGE_PAGE_SIZE));
+        if (block.memory != nullptr) {
+            block.backing = madvise(block.memory, block.size, MADV_HUGEPAGE) == 0 ? ARENA_BACKING::TRANSPARENT_HUGE_PAGES : ARENA_BACKING::PAGES;
+            return true;
+        }
+#endif
+    }
+
+    block.size = (size + 4095) / 4096 * 4096;
+    block.memory = static_cast<uint8_t*>(alloc_aligned(block.size, 4096));
+    block.backing = ARENA_BACKING::PAGES;
+    return block.memory != nullptr;
+}
+
+INLINE
+void arena_unmap_block(t_arena_block& block) {
+#if defined(_MSC_VER)
+    if (block.backing == ARENA_BACKING::HUGE_PAGES) {
+        VirtualFree(block.memory, 0, MEM_RELEASE);
+        return;
+    }
+#elif defined(__linux__)
+    if (block.backing == ARENA_BACKING::HUGE_PAGES) {
+        munmap(block.memory, block.size);
+        return;
+    }
+#endif
+    free_aligned(block.memory);
+}
+
+/// <summary>
+///  Create an arena, 'initial_size' is a hint for the first block so a typical solve fits in a single one
+/// </summary>
+INLINE
+t_arena* create_arena(size_t initial_size, bool huge_pages) {
+    auto arena = new t_arena();
+    arena->huge_pages = huge_pages;
+    t_arena_block block;
+    if (!arena_map_block(block, std::max(initial_size, ARENA_BLOCK_SIZE), huge_pages)) {
+        delete arena;
+        return nullptr;
+    }
+    arena->blocks.push_back(block);
+    return arena;
+}
+
+INLINE
+void free_arena(t_arena* arena) {
+    if (arena == nullptr)
+        return;
+    for (auto& block : arena->blocks) {
+        arena_unmap_block(block);
+    }
+    delete arena;
+}
+
+/// <summary>
+///  Carve 'size' bytes out of the arena, a new block is added when the last one is full. The memory is not cleared.
+/// </summary>
+/// <param name="name">Shows up in the memory map, has to outlive the arena ( a literal )</param>
+/// <returns>nullptr if the system is out of memory</returns>
+INLINE
+void* arena_alloc(t_arena& arena, size_t size, const char* name, size_t alignment = ARENA_ALIGNMENT) {
+    auto* block = &arena.blocks.back();
+    auto offset = (block->used + alignment - 1) / alignment * alignment;
+    if (offset + size > block->size) {
+        t_arena_block new_block;
+        if (!arena_map_block(new_block, std::max(size + alignment, ARENA_BLOCK_SIZE), arena.huge_pages))
+            return nullptr;
+        arena.blocks.push_back(new_block);
+        block = &arena.blocks.back();
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    arena.regions.push_back({
+        .name = name,
+        .block = static_cast<uint32_t>(arena.blocks.size() - 1),
+        .offset = offset,
+        .size = size
+    });
+    return block->memory + offset;
+}
+
+template<typename T>
+FORCE_INLINE
+T* arena_alloc_array(t_arena& arena, size_t count, const char* name, size_t alignment = ARENA_ALIGNMENT) {
+    return static_cast<T*>(arena_alloc(arena, sizeof(T) * count, name, std::max(alignment, alignof(T))));
+}
+
+/// <summary>
+///  Print the blocks and what they hold, allocations with the same name are summed up
+/// </summary>
+INLINE
+void print_arena_map(std::ostream* stream, const t_arena& arena) {
+    for (size_t idx = 0; idx < arena.blocks.size(); ++idx) {
+        const auto& block = arena.blocks[idx];
+        (*stream) << e2::format("Arena block {}: {} bytes at {} on {}, {} bytes used\n",
+            idx, block.size, static_cast<const void*>(block.memory), arena_backing_name(block.backing), block.used);
+
+        // Few distinct names, a linear search keeps them in the order of their first allocation
+        typedef struct {
+            const char* name;
+            size_t first_offset;
+            size_t allocations;
+            size_t size;
+        } t_usage;
+        std::vector<t_usage> usages;
+        for (const auto& region : arena.regions) {
+            if (region.block != idx)
+                continue;
+            auto usage = std::find_if(usages.begin(), usages.end(), [&region](const t_usage& entry) { return std::strcmp(entry.name, region.name) == 0; });
+            if (usage == usages.end()) {
+                usages.push_back({ .name = region.name, .first_offset = region.offset, .allocations = 0, .size = 0 });
+                usage = usages.end() - 1;
+            }
+            usage->allocations++;
+            usage->size += region.size;
+        }
+        for (const auto& usage : usages) {
+            (*stream) << e2::format("  {:#010x} {:<18} {:>10} bytes in {} allocation(s)\n", usage.first_offset, usage.name, usage.size, usage.allocations);
+        }
+    }
+}
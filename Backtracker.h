@@ -1,57 +1,212 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <immintrin.h>
+
 #include "Common.h"
 #include "Board.h"
+#include "CandidateFilter.h"
+#include "SearchPolicies.h"
+
+// Signature shared by all the backtracking variants, the workers pick one at startup
+typedef void(*t_backtrack_function)(t_board& board, uint32_t cell_index);
 
+/// <summary>
+///  As soon as a piece is placed the colors of the next cell are known, so is the slot holding its candidates.
+///  Load the slot early, it is the recursion's first load anyway, so the first candidates can be prefetched while
+///  the rest of the placement runs.
+///  The cell bellow also got its top color but its left color is only known when its left neighbor is placed,
+///  so there is nothing we can compute for it yet.
+/// </summary>
 FORCE_INLINE
+void prefetch_candidates(const t_board& board, uint32_t cell_index) {
+    if (cell_index >= board.total_cells)
+        return; // The dummy cell has no candidates
+    const auto& cell = board.cells[cell_index];
+    const auto pieces = board.cell_type_slots[cell.type][cell.left_color + cell.top_color];
+    if (pieces != nullptr)
+        _mm_prefetch(reinterpret_cast<const char*>(pieces->data()), _MM_HINT_T0);
+}
+
+/// <summary>
+///  The classic depth first search, all the bookkeeping goes through the policy ( see SearchPolicies.h )
+/// </summary>
+template<typename TPolicy, bool PREFETCH = false>
+INLINE
 void backtrack(t_board& board, uint32_t cell_index = 0) {
     // Keep track of the maximum depth we reached in the backtracking and store the current state
-    if (board.max_depth < cell_index) {
-        [[unlikely]]
-        board.max_depth = cell_index;
-        copy_cells(board);
-    }
+    TPolicy::snapshot::enter(board, cell_index);
 
     // If we reached the end of the board, we are done
     if (cell_index == board.total_cells) {
         [[unlikely]]
-        board.max_depth = cell_index;
-        board.total_solutions++;
         // We have a solution, print it or do something with it
-        board.solution_callback(board);
+        TPolicy::solution::found(board);
         return;
     }
 
-    auto& cell = board.cells[cell_index];
     // Get the vector responsible for the current cell
-    const auto pieces = cell.pieces[cell.left_color + cell.top_color];
-    if (pieces == nullptr || board.done)
+    const auto pieces = get_cell_candidates(board, cell_index);
+    if (pieces == nullptr) {
+        TPolicy::statistics::cell_done(board, cell_index, 0, 0);
+        return;
+    }
+    if (TPolicy::stop_check::stopped(board))
         return;
 
     // Loop through all possible pieces and do the stuff we need to do
+    uint32_t placed = 0;
     for (const auto& piece : *pieces)
     {
-        board.total_checked_nodes++;
+        TPolicy::statistics::checked(board, 1);
 
         // Check if the piece is used already
         if (board.used_pieces[piece.identifier.index])
             continue; // Piece already used
 
-        board.total_placed_nodes++;
+        TPolicy::statistics::placed(board);
+        placed++;
 
         // Update some basic and really important information
-        cell.identifier = piece.identifier;
-        board.cells[cell.right_cell_offset].left_color = piece.right;
-        board.cells[cell.bottom_cell_offset].top_color = piece.bottom;
+        place_piece(board, cell_index, piece);
+        TPolicy::snapshot::placing(board, cell_index, *pieces, static_cast<uint32_t>(&piece - pieces->data()));
+        if constexpr (PREFETCH) {
+            prefetch_candidates(board, cell_index + 1);
+        }
 
         // Mark the piece as used
         board.used_pieces[piece.identifier.index] = true;
 
         // Classic recursive backtrack
-        backtrack(board, cell_index + 1);
+        const auto mark = TPolicy::statistics::enter_candidate(board, cell_index);
+        backtrack<TPolicy, PREFETCH>(board, cell_index + 1);
+        TPolicy::statistics::leave_candidate(board, piece, mark);
 
         // Release the piece for usage
         board.used_pieces[piece.identifier.index] = false;
     }
+
+    TPolicy::statistics::cell_done(board, cell_index, pieces->size(), placed);
 }
 
+/// <summary>
+///  Same search as 'backtrack' but long candidate lists are tested in blocks with one of the vector kernels and
+///  the loop only visits the candidates that are still available. The used flags of a block can be tested up front
+///  since every recursion releases the pieces it used before returning.
+/// </summary>
+template<typename TKernel, typename TPolicy, bool PREFETCH = false>
+void backtrack_blocks(t_board& board, uint32_t cell_index = 0) {
+    // Keep track of the maximum depth we reached in the backtracking and store the current state
+    TPolicy::snapshot::enter(board, cell_index);
+
+    // If we reached the end of the board, we are done
+    if (cell_index == board.total_cells) {
+        [[unlikely]]
+        TPolicy::solution::found(board);
+        return;
+    }
+
+    // Get the vector responsible for the current cell
+    const auto pieces = get_cell_candidates(board, cell_index);
+    if (pieces == nullptr) {
+        TPolicy::statistics::cell_done(board, cell_index, 0, 0);
+        return;
+    }
+    if (TPolicy::stop_check::stopped(board))
+        return;
+
+    const auto candidates = pieces->data();
+    const auto count = static_cast<uint32_t>(pieces->size());
+    uint32_t placed = 0;
+    if (count < TKernel::MIN_CANDIDATES) {
+        // Short lists ( most inner slots ) are cheaper to test one by one
+        for (uint32_t idx = 0; idx < count; ++idx)
+        {
+            const auto& piece = candidates[idx];
+            TPolicy::statistics::checked(board, 1);
+
+            if (board.used_pieces[piece.identifier.index])
+                continue; // Piece already used
+
+            TPolicy::statistics::placed(board);
+            placed++;
+
+            place_piece(board, cell_index, piece);
+            TPolicy::snapshot::placing(board, cell_index, *pieces, idx);
+            if constexpr (PREFETCH) {
+                prefetch_candidates(board, cell_index + 1);
+            }
+
+            board.used_pieces[piece.identifier.index] = true;
+            const auto mark = TPolicy::statistics::enter_candidate(board, cell_index);
+            backtrack_blocks<TKernel, TPolicy, PREFETCH>(board, cell_index + 1);
+            TPolicy::statistics::leave_candidate(board, piece, mark);
+            board.used_pieces[piece.identifier.index] = false;
+        }
+    }
+    else {
+        for (uint32_t block = 0; block < count; block += TKernel::BLOCK_SIZE)
+        {
+            const auto block_count = std::min(TKernel::BLOCK_SIZE, count - block);
+            TPolicy::statistics::checked(board, block_count);
+
+            // Only the survivors of the block
+            auto viable = TKernel::viable_mask(candidates + block, block_count, board.used_pieces);
+            while (viable != 0) {
+                const auto position = block + static_cast<uint32_t>(std::countr_zero(viable));
+                const auto& piece = candidates[position];
+                viable &= viable - 1;
+
+                TPolicy::statistics::placed(board);
+                placed++;
+
+                place_piece(board, cell_index, piece);
+                TPolicy::snapshot::placing(board, cell_index, *pieces, position);
+                if constexpr (PREFETCH) {
+                    prefetch_candidates(board, cell_index + 1);
+                }
+
+                board.used_pieces[piece.identifier.index] = true;
+                const auto mark = TPolicy::statistics::enter_candidate(board, cell_index);
+                backtrack_blocks<TKernel, TPolicy, PREFETCH>(board, cell_index + 1);
+                TPolicy::statistics::leave_candidate(board, piece, mark);
+                board.used_pieces[piece.identifier.index] = false;
+            }
+        }
+    }
+
+    TPolicy::statistics::cell_done(board, cell_index, count, placed);
+}
+
+/// <summary>
+///  Pick the backtracker for an instruction set, the caller makes sure the CPU supports it
+/// </summary>
+template<typename TPolicy, bool PREFETCH>
+INLINE
+t_backtrack_function get_backtrack_function(KERNEL_ISA::KERNEL_ISA isa) {
+    switch (isa) {
+    case KERNEL_ISA::AVX512:
+        return backtrack_blocks<t_avx512_kernel, TPolicy, PREFETCH>;
+    case KERNEL_ISA::AVX2:
+        return backtrack_blocks<t_avx2_kernel, TPolicy, PREFETCH>;
+    default:
+        return backtrack<TPolicy, PREFETCH>;
+    }
+}
+
+template<typename TPolicy>
+INLINE
+t_backtrack_function get_backtrack_function(KERNEL_ISA::KERNEL_ISA isa, bool prefetch) {
+    return prefetch ? get_backtrack_function<TPolicy, true>(isa) : get_backtrack_function<TPolicy, false>(isa);
+}
+
+/// <summary>
+///  All the combinations live in the binary, the profile picks the instantiation at startup
+/// </summary>
+INLINE
+t_backtrack_function get_backtrack_function(KERNEL_ISA::KERNEL_ISA isa, bool prefetch, SEARCH_PROFILE::SEARCH_PROFILE profile) {
+    if (profile == SEARCH_PROFILE::THROUGHPUT)
+        return get_backtrack_function<t_throughput_policy>(isa, prefetch);
+    return get_backtrack_function<t_diagnostic_policy>(isa, prefetch);
+}
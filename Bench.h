@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include "Common.h"
+#include "Options.h"
+#include "Formatters.h"
+#include "PerfCounters.h"
+
+// Solves one puzzle with the given options, this is 'main' without the command line
+typedef int(*t_solve_function)(const std::shared_ptr<t_options>& options, t_statistics_data& statistics);
+
+typedef struct {
+    const char* file;
+    // Count every solution, otherwise stop after the node budget
+    bool exhaustive;
+} t_bench_puzzle;
+
+// The puzzle ladder in data/, everything above 6x6 takes too long to count so it only gets a node budget
+const t_bench_puzzle BENCH_PUZZLES[] = {
+    { "pieces_04x04.txt", true },
+    { "pieces_05x05.txt", true },
+    { "pieces_06x06.txt", true },
+    { "pieces_07x07.txt", false },
+    { "pieces_08x08.txt", false },
+    { "pieces_09x09.txt", false },
+    { "pieces_10x10.txt", false },
+    { "pieces_11x11.txt", false },
+    { "pieces_12x12.txt", false },
+    { "pieces_13x13.txt", false },
+    { "pieces_14x14.txt", false },
+    { "pieces_15x15.txt", false },
+    { "pieces_16x16.txt", false },
+    { "e2.txt", false },
+};
+
+typedef struct {
+    uint64_t solutions;
+    uint64_t placed_nodes;
+    uint64_t checked_nodes;
+    uint64_t clock_cycles;
+    double seconds;
+    // Loading, setting up and waiting for the first work unit
+    double startup_seconds;
+    uint64_t peak_rss;
+    t_perf_values perf;
+} t_bench_run;
+
+typedef struct {
+    double median;
+    double min;
+    double max;
+} t_bench_summary;
+
+typedef struct {
+    const t_bench_puzzle* puzzle;
+    std::vector<t_bench_run> runs;
+    t_bench_summary placed_per_second;
+    t_bench_summary checked_per_second;
+    t_bench_summary cycles_per_placed_node;
+    t_bench_summary seconds;
+    t_bench_summary startup_seconds;
+    uint64_t peak_rss;
+    // Median placed nodes per second of the baseline, if it has this puzzle
+    std::optional<double> baseline;
+    bool regression;
+} t_bench_result;
+
+/// <summary>
+///  Start a new peak RSS measurement, only Linux can reset the high water mark, everywhere else the peak is for
+///  the whole process so far
+/// </summary>
+INLINE
+void reset_peak_rss() {
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+#endif
+}
+
+INLINE
+uint64_t read_peak_rss() {
+#if defined(_MSC_VER)
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.starts_with("VmHWM:"))
+            return std::stoull(line.substr(6)) * 1024;
+    }
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+INLINE
+t_bench_summary summarize(std::vector<double> values) {
+    t_bench_summary summary = {};
+    if (values.empty())
+        return summary;
+    std::sort(values.begin(), values.end());
+    const auto middle = values.size() / 2;
+    summary.median = values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+    summary.min = values.front();
+    summary.max = values.back();
+    return summary;
+}
+
+// Distance between the slowest and the fastest run relative to the median
+INLINE
+double spread(const t_bench_summary& summary) {
+    return summary.median > 0.0 ? (summary.max - summary.min) / summary.median : 0.0;
+}
+
+/// <summary>
+///  Find the median placed nodes per second of a puzzle in a result file written by 'write_bench_results'.
+///  This is not a JSON parser, it only knows the layout we write.
+/// </summary>
+INLINE
+std::optional<double> find_baseline(const std::string& baseline, const std::string& puzzle) {
+    const auto puzzle_position = baseline.find(e2::format("\"puzzle\": \"{}\"", puzzle));
+    if (puzzle_position == std::string::npos)
+        return std::nullopt;
+    const auto metric_position = baseline.find("\"placed_per_second\"", puzzle_position);
+    if (metric_position == std::string::npos)
+        return std::nullopt;
+    const auto median_position = baseline.find("\"median\":", metric_position);
+    if (median_position == std::string::npos)
+        return std::nullopt;
+    try {
+        return std::stod(baseline.substr(median_position + 9, 32));
+    }
+    catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+INLINE
+std::string format_bench_summary(const t_bench_summary& summary) {
+    return e2::format("{{ \"median\": {:.3f}, \"min\": {:.3f}, \"max\": {:.3f}, \"spread\": {:.4f} }}",
+        summary.median, summary.min, summary.max, spread(summary));
+}
+
+INLINE
+bool write_bench_results(const std::string& file_name, const std::shared_ptr<t_options>& options, const std::vector<t_bench_result>& results) {
+    std::ofstream output(file_name);
+    if (!output.is_open())
+        return false;
+
+    output << e2::format("{{\n  \"repeat\": {},\n  \"node_budget\": {},\n  \"threads\": {},\n  \"isa\": \"{}\",\n  \"profile\": \"{}\",\n  \"puzzles\": [",
+        options->BenchRepeat, options->BenchNodes, options->MaxThreads, options->Isa, options->Profile);
+    for (size_t idx = 0; idx < results.size(); ++idx) {
+        const auto& result = results[idx];
+        const auto& last_run = result.runs.back();
+        output << e2::format("{}\n    {{\n", idx == 0 ? "" : ",");
+        output << e2::format("      \"puzzle\": \"{}\",\n", result.puzzle->file);
+        output << e2::format("      \"mode\": \"{}\",\n", result.puzzle->exhaustive ? "exhaustive" : "budget");
+        output << e2::format("      \"runs\": {},\n", result.runs.size());
+        output << e2::format("      \"solutions\": {},\n", last_run.solutions);
+        output << e2::format("      \"placed_nodes\": {},\n", last_run.placed_nodes);
+        output << e2::format("      \"checked_nodes\": {},\n", last_run.checked_nodes);
+        output << e2::format("      \"checked_per_placed\": {:.4f},\n",
+            last_run.placed_nodes > 0 ? static_cast<double>(last_run.checked_nodes) / static_cast<double>(last_run.placed_nodes) : 0.0);
+        output << e2::format("      \"placed_per_second\": {},\n", format_bench_summary(result.placed_per_second));
+        output << e2::format("      \"checked_per_second\": {},\n", format_bench_summary(result.checked_per_second));
+        output << e2::format("      \"cycles_per_placed_node\": {},\n", format_bench_summary(result.cycles_per_placed_node));
+        output << e2::format("      \"wall_seconds\": {},\n", format_bench_summary(result.seconds));
+        output << e2::format("      \"startup_seconds\": {},\n", format_bench_summary(result.startup_seconds));
+        output << e2::format("      \"peak_rss_bytes\": {}", result.peak_rss);
+        if (last_run.perf.valid != 0) {
+            // Hardware counters of the last run, normalized per node
+            const auto placed = static_cast<double>(std::max<uint64_t>(1, last_run.placed_nodes));
+            const auto checked = static_cast<double>(std::max<uint64_t>(1, last_run.checked_nodes));
+            output << ",\n      \"perf\": {";
+            bool first = true;
+            for (uint8_t event = 0; event < PERF_EVENT::MAX; ++event) {
+                if (!is_perf_event_valid(last_run.perf, static_cast<PERF_EVENT::PERF_EVENT>(event)))
+                    continue;
+                output << e2::format("{}\n        \"{}\": {{ \"total\": {}, \"per_placed\": {:.4f}, \"per_checked\": {:.4f} }}",
+                    first ? "" : ",",
+                    perf_event_name(static_cast<PERF_EVENT::PERF_EVENT>(event)),
+                    last_run.perf.values[event],
+                    static_cast<double>(last_run.perf.values[event]) / placed,
+                    static_cast<double>(last_run.perf.values[event]) / checked);
+                first = false;
+            }
+            output << "\n      }";
+        }
+        if (result.baseline.has_value()) {
+            output << e2::format(",\n      \"baseline_placed_per_second\": {:.3f},\n      \"regression\": {}",
+                result.baseline.value(), result.regression ? "true" : "false");
+        }
+        output << "\n    }";
+    }
+    output << "\n  ]\n}\n";
+    return output.good();
+}
+
+/// <summary>
+///  Run every puzzle of the ladder 'BenchRepeat' times, the small ones are counted to the end, the others stop
+///  after 'BenchNodes' placed nodes. The search options ( threads, isa, prefetch, profile ... ) are the ones from
+///  the command line. Returns RETURN_ERR if a run failed or a puzzle is slower than the baseline allows.
+/// </summary>
+INLINE
+int run_benchmark(const std::shared_ptr<t_options>& options, t_solve_function solve) {
+    // The throughput build neither counts the nodes the report is made of nor stops at the node budget
+    if (options->Profile == search_profile_name(SEARCH_PROFILE::THROUGHPUT)) {
+        std::cerr << "The benchmark measures placed nodes, it can not run the throughput profile\n";
+        return RETURN_ERR;
+    }
+    std::string baseline;
+    if (!options->BenchBaseline.empty()) {
+        std::ifstream baseline_file(options->BenchBaseline);
+        if (!baseline_file.is_open()) {
+            std::cerr << e2::format("Failed to read the benchmark baseline: {}\n", options->BenchBaseline);
+            return RETURN_ERR;
+        }
+        std::stringstream buffer;
+        buffer << baseline_file.rdbuf();
+        baseline = buffer.str();
+    }
+
+    const auto repeat = std::max<int64_t>(1, options->BenchRepeat);
+    int status = RETURN_OK;
+    std::vector<t_bench_result> results;
+    for (const auto& puzzle : BENCH_PUZZLES) {
+        const auto path = std::filesystem::path(options->BenchData) / puzzle.file;
+        if (!std::filesystem::exists(path)) {
+            std::cout << e2::format("{:<18} missing, skipped\n", puzzle.file);
+            continue;
+        }
+
+        auto run_options = std::make_shared<t_options>(*options);
+        run_options->Bench = false;
+        run_options->PuzzleFile = path.string();
+        run_options->MaxNodesToPlace = puzzle.exhaustive ? -1 : options->BenchNodes;
+        run_options->FirstSolution = false;
+        run_options->Portfolio = false;
+        run_options->Restart = "none";
+        run_options->AdaptiveOrder = false;
+        run_options->OrderFile.clear();
+        run_options->DisplayOnConsole = false;
+        run_options->Bucas = false;
+        run_options->HeatmapFile.clear();
+
+        t_bench_result result = {};
+        result.puzzle = &puzzle;
+        for (int64_t iteration = 0; iteration < repeat; ++iteration) {
+            t_statistics_data statistics;
+            reset_peak_rss();
+            // The solver talks a lot, we only want the numbers
+            const auto console = std::cout.rdbuf(nullptr);
+            const auto solve_status = solve(run_options, statistics);
+            std::cout.rdbuf(console);
+            if (solve_status != RETURN_OK)
+                break;
+
+            result.runs.push_back({
+                .solutions = statistics.total_solutions.load(),
+                .placed_nodes = statistics.total_nodes_placed.load(),
+                .checked_nodes = statistics.total_nodes_checked.load(),
+                .clock_cycles = statistics.end_clock_cycles - statistics.start_clock_cycles,
+                .seconds = std::chrono::duration<double>(statistics.end_time - statistics.start_time).count(),
+                .startup_seconds = std::chrono::duration<double>(statistics.load_time + statistics.setup_time + statistics.first_unit_time).count(),
+                .peak_rss = read_peak_rss(),
+                .perf = statistics.perf
+            });
+        }
+        if (result.runs.empty()) {
+            std::cout << e2::format("{:<18} failed\n", puzzle.file);
+            status = RETURN_ERR;
+            continue;
+        }
+
+        std::vector<double> placed_per_second, checked_per_second, cycles_per_placed_node, seconds, startup_seconds;
+        for (const auto& run : result.runs) {
+            const auto run_seconds = std::max(run.seconds, 1e-9);
+            placed_per_second.push_back(static_cast<double>(run.placed_nodes) / run_seconds);
+            checked_per_second.push_back(static_cast<double>(run.checked_nodes) / run_seconds);
+            cycles_per_placed_node.push_back(run.placed_nodes > 0 ? static_cast<double>(run.clock_cycles) / static_cast<double>(run.placed_nodes) : 0.0);
+            seconds.push_back(run.seconds);
+            startup_seconds.push_back(run.startup_seconds);
+            result.peak_rss = std::max(result.peak_rss, run.peak_rss);
+        }
+        result.placed_per_second = summarize(placed_per_second);
+        result.checked_per_second = summarize(checked_per_second);
+        result.cycles_per_placed_node = summarize(cycles_per_placed_node);
+        result.seconds = summarize(seconds);
+        result.startup_seconds = summarize(startup_seconds);
+
+        std::string comparison;
+        if (!baseline.empty()) {
+            result.baseline = find_baseline(baseline, puzzle.file);
+            if (result.baseline.has_value() && result.baseline.value() > 0.0) {
+                const auto change = (result.placed_per_second.median / result.baseline.value() - 1.0) * 100.0;
+                result.regression = change < -options->BenchThreshold;
+                comparison = e2::format(" | baseline {:+.1f}%{}", change, result.regression ? " REGRESSION" : "");
+                if (result.regression)
+                    status = RETURN_ERR;
+            }
+        }
+
+        const auto& last_run = result.runs.back();
+        std::cout << e2::format("{:<18} {:<10} {} pps (spread {:.1f}%) | {} cps | {:.2f} checked/placed | {:.1f} cycles/placed | {:.3f}s (startup {:.3f}s) | {} MB RSS{}\n",
+            puzzle.file,
+            puzzle.exhaustive ? "exhaustive" : "budget",
+            format_number_human_readable(static_cast<int64_t>(result.placed_per_second.median)),
+            spread(result.placed_per_second) * 100.0,
+            format_number_human_readable(static_cast<int64_t>(result.checked_per_second.median)),
+            last_run.placed_nodes > 0 ? static_cast<double>(last_run.checked_nodes) / static_cast<double>(last_run.placed_nodes) : 0.0,
+            result.cycles_per_placed_node.median,
+            result.seconds.median,
+            result.startup_seconds.median,
+            result.peak_rss / (1024 * 1024),
+            comparison);
+        results.push_back(std::move(result));
+    }
+
+    if (!options->BenchOutput.empty()) {
+        if (write_bench_results(options->BenchOutput, options, results))
+            std::cout << e2::format("Benchmark results written to {}\n", options->BenchOutput);
+        else {
+            std::cerr << e2::format("Failed to write the benchmark results to {}\n", options->BenchOutput);
+            status = RETURN_ERR;
+        }
+    }
+    return status;
+}
@@ -1,70 +1,125 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <memory>
+#include "Arena.h"
 #include "Common.h"
 
+// Point the cells of the board at the candidate lists of a matrix, any matrix with the same slots will do ( see
+// create_shuffled_piece_matrix )
+INLINE
+void set_board_matrix(t_board& board, const t_piece_matrix_vector* piece_matrix_vector) {
+    for (uint32_t type = 0; type < CELL_TYPE::MAX; ++type) {
+        board.cell_type_slots[type] = &piece_matrix_vector->pieces[type * piece_matrix_vector->cell_type_offset];
+    }
+}
+
 /// <summary>
-///  The board has one extra cell that is used as a dummy cell
+///  The board has one extra row of padding cells
 ///  0 1 2
 ///  3 4 5
-///  6 7 8 9 <- Dummy cell
+///  6 7 8
+///  9 . . <- Padding
 ///  
-///  Cell 2 has no right neighbor, so we point it to cell 9
-///  Cell 5 has no right neighbor, so we point it to cell 9
-///  Cell 6 has no bottom neighbor, so we point it to cell 9
-///  Cell 7 has no bottom neighbor, so we point it to cell 9
-///  Cell 8 has no right or bottom neighbor, so we point it to cell 9
-/// 
-///  It also has a duplicated cells array in continuation of the main one,
-///  that is used to quickly copy the cells when we need to save a solution
+///  The neighbors are implicit ( see t_cell ), cell 2 writes its right color in cell 3 and the bottom row writes its
+///  bottom colors in the padding row.
+///  The pieces on the board live in their own array after the cells, followed by a second one that keeps the deepest
+///  board we reached.
+///  Boards live in the solver arena and go away with it.
 /// </summary>
 /// <param name="puzzleData"></param>
 /// <param name="piece_matrix_vector"></param>
+/// <param name="arena"></param>
 /// <returns></returns>
 INLINE
-t_board* create_board(const std::shared_ptr<t_PuzzleData>& puzzleData, t_piece_matrix_vector* piece_matrix_vector) {
-    auto memorySize = sizeof(t_board) + 2 /* Two sets of cells */ * (sizeof(t_cell) * puzzleData->width * puzzleData->height + 1);
-    auto board = static_cast<t_board*>(_aligned_malloc(memorySize, 4096));
+t_board* create_board(const std::shared_ptr<t_PuzzleData>& puzzleData, t_piece_matrix_vector* piece_matrix_vector, t_arena& arena) {
+    const auto total_cells = puzzleData->width * puzzleData->height;
+    const auto actual_total_cells = total_cells + puzzleData->width;
+    auto memorySize = sizeof(t_board) + sizeof(t_cell) * actual_total_cells + 2 /* Two sets of identifiers */ * sizeof(t_piece_identifier) * total_cells;
+    auto board = static_cast<t_board*>(arena_alloc(arena, memorySize, "boards"));
     if (!board) {
         return nullptr; // Memory allocation failed
     }
     memset(board, 0, memorySize);
 
-    board->total_cells = static_cast<uint16_t>(puzzleData->width * puzzleData->height);
-    /* We need 1 dummy cell to point everything that does not have a neighbor to this*/
-    board->actual_total_cells = board->total_cells + 1;
+    board->total_cells = total_cells;
+    board->actual_total_cells = actual_total_cells;
     board->cells_stride = puzzleData->width;
+    board->identifiers = reinterpret_cast<t_piece_identifier*>(&board->cells[actual_total_cells]);
+    board->best_identifiers = board->identifiers + total_cells;
+    // Only the restarting search sets a budget
+    board->node_budget = std::numeric_limits<uint64_t>::max();
+    set_board_matrix(*board, piece_matrix_vector);
 
-    auto cells_memory_size = sizeof(t_cell) * (board->actual_total_cells);
-    uint16_t dummy_cell_index = static_cast<uint16_t>(board->total_cells);
-
-    // Initialize all cells to a known value
-    for (uint32_t idx = 0; idx < board->total_cells; ++idx) {
-        board->cells[idx].right_cell_offset = static_cast<uint16_t>(idx + 1);
-        board->cells[idx].bottom_cell_offset = static_cast<uint16_t>(idx + board->cells_stride);
-        board->cells[idx].pieces = &piece_matrix_vector->pieces[CELL_TYPE::INNER * piece_matrix_vector->cell_type_offset];
-    }
-
+    // Everything is an inner cell ( zero ) but the bottom row and the right column
     for (uint32_t idx = 0; idx < puzzleData->width; ++idx) {
-        auto cellIdx = get_idx(idx, puzzleData->height - 1, puzzleData->width);
-        board->cells[cellIdx].bottom_cell_offset = dummy_cell_index;
-        board->cells[cellIdx].pieces = &piece_matrix_vector->pieces[CELL_TYPE::BORDER_BOTTOM * piece_matrix_vector->cell_type_offset];
+        board->cells[get_idx(idx, puzzleData->height - 1, puzzleData->width)].type = CELL_TYPE::BORDER_BOTTOM;
     }
-
     for (uint32_t idx = 0; idx < puzzleData->height; ++idx) {
-        auto cellIdx = get_idx(puzzleData->width - 1, idx, puzzleData->width);
-        board->cells[cellIdx].right_cell_offset = dummy_cell_index;
-        board->cells[cellIdx].pieces = &piece_matrix_vector->pieces[CELL_TYPE::BORDER_RIGHT * piece_matrix_vector->cell_type_offset];
+        board->cells[get_idx(puzzleData->width - 1, idx, puzzleData->width)].type = CELL_TYPE::BORDER_RIGHT;
     }
 
     return board;
 }
 
+// The candidates for a cell, from its type and the colors its neighbors left in it
+FORCE_INLINE
+const t_candidate_list* get_cell_candidates(const t_board& board, uint32_t cell_index) {
+    const auto& cell = board.cells[cell_index];
+    return board.cell_type_slots[cell.type][cell.left_color + cell.top_color];
+}
+
+// Put a piece in a cell and hand its colors to the neighbors, the used flag is up to the caller
+FORCE_INLINE
+void place_piece(t_board& board, uint32_t cell_index, const t_precalculated_piece& piece) {
+    board.identifiers[cell_index] = piece.identifier;
+    board.cells[cell_index + 1].left_color = static_cast<uint16_t>(piece.right);
+    board.cells[cell_index + board.cells_stride].top_color = piece.bottom;
+}
+
+/// <summary>
+///  Put the pieces of a work unit on the board, the colors come from the candidate lists of the cells
+/// </summary>
+/// <returns>The cell the search starts from, WORK_UNIT_INVALID if a piece does not fit its cell</returns>
+INLINE
+uint32_t apply_work_unit(const t_work_unit& unit, t_board* board) {
+    // First mark all pieces as unused
+    std::fill(std::begin(board->used_pieces), std::end(board->used_pieces), false);
+
+    for (uint32_t cell_index = 0; cell_index < unit.depth; ++cell_index) {
+        const auto identifier = unit.pieces[cell_index];
+        const auto pieces = get_cell_candidates(*board, cell_index);
+        if (pieces == nullptr)
+            return WORK_UNIT_INVALID;
+        const auto piece = std::find_if(pieces->begin(), pieces->end(), [identifier](const t_precalculated_piece& candidate) {
+            return candidate.identifier.index == identifier.index && candidate.identifier.rotation == identifier.rotation;
+        });
+        if (piece == pieces->end() || board->used_pieces[identifier.index])
+            return WORK_UNIT_INVALID;
+        place_piece(*board, cell_index, *piece);
+        board->used_pieces[identifier.index] = true;
+    }
+    return unit.depth;
+}
+
 void copy_cells(t_board& board) {
-    memcpy(&board.cells[board.actual_total_cells], &board.cells[0], sizeof(t_cell) * (board.actual_total_cells));
+    memcpy(board.best_identifiers, board.identifiers, sizeof(t_piece_identifier) * board.total_cells);
+}
+
+
+// The board is packed so 'done' can not be a std::atomic, these are the atomic accesses to it
+FORCE_INLINE
+bool board_done(t_board& board) {
+    return std::atomic_ref<bool>(board.done).load(std::memory_order_relaxed);
 }
 
+FORCE_INLINE
+void set_board_done(t_board& board, bool done) {
+    std::atomic_ref<bool>(board.done).store(done);
+}
 
 void  stop_board(t_board& board) {
-    board.done = true;
-}
\ No newline at end of file
+    set_board_done(board, true);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include "Common.h"
+
+// The kernels below read the candidates as 32 bit lanes, the second lane of each candidate holds the identifier
+static_assert(sizeof(t_precalculated_piece) == 8, "The candidate filter expects 8 byte candidates");
+
+namespace KERNEL_ISA {
+    enum KERNEL_ISA : uint8_t {
+        SCALAR = 0,
+        AVX2,
+        AVX512,
+        MAX = AVX512 + 1
+    };
+}
+
+/// <summary>
+///  Test a block of up to 8 candidates against the used pieces in one go
+///  - load the candidates as two 256 bit vectors ( masked, so we never read past the end of the vector )
+///  - keep the lane that holds 'bottom | index | rotation' for each candidate and extract the piece index
+///  - gather the used flags for all 8 indexes
+/// The gather reads 4 bytes for every flag, for the last pieces that goes past the used pieces array into the
+/// rest of the board, it is still inside the board allocation and the extra bytes are masked out.
+/// </summary>
+/// <param name="candidates">First candidate in the block</param>
+/// <param name="count">Number of valid candidates in the block, 1 to 8</param>
+/// <param name="used_pieces">The used pieces flags from the board</param>
+/// <returns>Bit N is set if candidate N is not used yet</returns>
+TARGET_AVX2
+uint32_t avx2_viable_mask(const t_precalculated_piece* candidates, uint32_t count, const bool* used_pieces) {
+    const auto count_vector = _mm256_set1_epi32(static_cast<int>(count));
+    const auto load_mask_low = _mm256_cmpgt_epi32(count_vector, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3));
+    const auto load_mask_high = _mm256_cmpgt_epi32(count_vector, _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7));
+    const auto lane_mask = _mm256_cmpgt_epi32(count_vector, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    const auto low = _mm256_maskload_epi32(reinterpret_cast<const int*>(candidates), load_mask_low);
+    const auto high = _mm256_maskload_epi32(reinterpret_cast<const int*>(candidates + 4), load_mask_high);
+
+    // Move the odd lanes ( identifier lanes ) next to each other and merge the two halves
+    const auto odd_lanes = _mm256_setr_epi32(1, 3, 5, 7, 1, 3, 5, 7);
+    const auto identifiers = _mm256_blend_epi32(
+        _mm256_permutevar8x32_epi32(low, odd_lanes),
+        _mm256_permutevar8x32_epi32(high, odd_lanes),
+        0xF0);
+    const auto byte_mask = _mm256_set1_epi32(0xFF);
+    const auto indexes = _mm256_and_si256(_mm256_srli_epi32(identifiers, 8), byte_mask);
+
+    const auto used = _mm256_and_si256(
+        _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(used_pieces), indexes, lane_mask, 1),
+        byte_mask);
+    const auto viable = _mm256_and_si256(_mm256_cmpeq_epi32(used, _mm256_setzero_si256()), lane_mask);
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(viable)));
+}
+
+/// <summary>
+///  Same as the AVX2 version but for blocks of up to 16 candidates, the masks are native so the tail needs no
+///  extra work and the identifiers of both halves are collected with a single two source permute.
+/// </summary>
+TARGET_AVX512
+uint32_t avx512_viable_mask(const t_precalculated_piece* candidates, uint32_t count, const bool* used_pieces) {
+    const auto lane_mask = static_cast<__mmask16>(count >= 16 ? 0xFFFF : (1u << count) - 1);
+    const auto load_mask_low = static_cast<__mmask16>(count >= 8 ? 0xFFFF : (1u << (2 * count)) - 1);
+    const auto load_mask_high = static_cast<__mmask16>(count >= 16 ? 0xFFFF : count <= 8 ? 0 : (1u << (2 * (count - 8))) - 1);
+
+    const auto low = _mm512_maskz_loadu_epi32(load_mask_low, candidates);
+    const auto high = _mm512_maskz_loadu_epi32(load_mask_high, candidates + 8);
+
+    const auto odd_lanes = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    const auto identifiers = _mm512_permutex2var_epi32(low, odd_lanes, high);
+    const auto byte_mask = _mm512_set1_epi32(0xFF);
+    const auto indexes = _mm512_and_si512(_mm512_srli_epi32(identifiers, 8), byte_mask);
+
+    const auto used = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lane_mask, indexes, used_pieces, 1);
+    return static_cast<uint32_t>(_mm512_mask_testn_epi32_mask(lane_mask, used, byte_mask));
+}
+
+// Kernels used by the block backtracker, a block holds up to BLOCK_SIZE candidates and lists shorter than
+// MIN_CANDIDATES are tested one by one since they are not worth the setup cost of the vector code
+typedef struct st_avx2_kernel {
+    static constexpr uint32_t BLOCK_SIZE = 8;
+    static constexpr uint32_t MIN_CANDIDATES = 8;
+
+    FORCE_INLINE
+    static uint32_t viable_mask(const t_precalculated_piece* candidates, uint32_t count, const bool* used_pieces) {
+        return avx2_viable_mask(candidates, count, used_pieces);
+    }
+} t_avx2_kernel;
+
+typedef struct st_avx512_kernel {
+    static constexpr uint32_t BLOCK_SIZE = 16;
+    static constexpr uint32_t MIN_CANDIDATES = 12;
+
+    FORCE_INLINE
+    static uint32_t viable_mask(const t_precalculated_piece* candidates, uint32_t count, const bool* used_pieces) {
+        return avx512_viable_mask(candidates, count, used_pieces);
+    }
+} t_avx512_kernel;
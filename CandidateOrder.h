@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Arena.h"
+#include "Board.h"
+#include "Common.h"
+
+namespace CANDIDATE_SCORE {
+    enum CANDIDATE_SCORE : uint8_t {
+        // Average deepest cell the search reached below the candidate, the deeper first
+        DEPTH = 0,
+        // Solutions per node placed below the candidate, the richer first
+        YIELD,
+        MAX = YIELD + 1
+    };
+}
+
+// A new order needs at least that many times the placements of the one before, the orders live until the end of
+// the search so there are only a few dozen of them
+constexpr uint64_t CANDIDATE_REORDER_GROWTH = 2;
+// The list header takes the room of that many candidates, so every candidate has a position in the lists block
+constexpr uint32_t CANDIDATE_LIST_HEADER = sizeof(t_candidate_list) / sizeof(t_precalculated_piece);
+static_assert(sizeof(t_candidate_list) % sizeof(t_precalculated_piece) == 0, "The list header has to be a whole number of candidates");
+
+INLINE
+const char* candidate_score_name(CANDIDATE_SCORE::CANDIDATE_SCORE score) {
+    switch (score) {
+    case CANDIDATE_SCORE::YIELD:
+        return "yield";
+    default:
+        return "depth";
+    }
+}
+
+INLINE
+std::optional<CANDIDATE_SCORE::CANDIDATE_SCORE> parse_candidate_score(const std::string& name) {
+    for (uint8_t score = 0; score < CANDIDATE_SCORE::MAX; ++score) {
+        if (name == candidate_score_name(static_cast<CANDIDATE_SCORE::CANDIDATE_SCORE>(score)))
+            return static_cast<CANDIDATE_SCORE::CANDIDATE_SCORE>(score);
+    }
+    return std::nullopt;
+}
+
+/// <summary>
+///  Counters of one candidate, over every time it was placed
+/// </summary>
+typedef struct {
+    uint64_t placements;
+    // Nodes placed in the subtrees below it
+    uint64_t nodes;
+    uint64_t solutions;
+    // Sum of the deepest cell reached below it, divided by the placements it is the average depth
+    uint64_t depth;
+} t_candidate_counts;
+
+/// <summary>
+///  One order of the candidates: a copy of the piece matrix with its lists in one block, and for every position of
+///  that block the id of the candidate sitting there. The ids are the positions in the first order, so the counters
+///  stay with their candidate whatever order the board searches with.
+/// </summary>
+typedef struct {
+    t_piece_matrix_vector* matrix;
+    const t_precalculated_piece* base;
+    const uint32_t* ids;
+} t_candidate_order;
+
+/// <summary>
+///  Per thread counters, only the owning thread writes them ( relaxed atomics, so the reordering can read them
+///  while the search runs )
+/// </summary>
+typedef struct st_candidate_statistics {
+    // The order the board searches with, picked up between work units
+    const t_candidate_order* order;
+    t_candidate_counts* counts;
+    // Deepest cell finished since the last candidate was placed
+    uint32_t deepest;
+} t_candidate_statistics;
+
+// Taken before the search goes below a candidate
+typedef struct {
+    uint64_t placed_nodes;
+    uint64_t solutions;
+    uint32_t deepest;
+} t_candidate_mark;
+
+/// <summary>
+///  Shared by all the threads. The reordering builds a new order from the counters of every thread and publishes
+///  it, each worker switches to it before its next work unit. Nobody waits for anybody, the old orders stay valid.
+/// </summary>
+typedef struct {
+    CANDIDATE_SCORE::CANDIDATE_SCORE score;
+    const t_candidate_order* first;
+    uint32_t total_ids;
+    std::atomic<const t_candidate_order*> current;
+    // Counters loaded from the order file
+    std::vector<t_candidate_counts> prior;
+    std::vector<t_candidate_statistics*> threads;
+    // Orders published after the first one, and the placements the last one was built from
+    uint32_t reorders;
+    uint64_t last_placements;
+} t_candidate_ordering;
+
+FORCE_INLINE
+void add_candidate_count(uint64_t& counter, uint64_t value) {
+    std::atomic_ref<uint64_t>(counter).store(counter + value, std::memory_order_relaxed);
+}
+
+FORCE_INLINE
+uint64_t load_candidate_count(uint64_t& counter) {
+    return std::atomic_ref<uint64_t>(counter).load(std::memory_order_relaxed);
+}
+
+FORCE_INLINE
+void reach_candidate_depth(t_candidate_statistics& statistics, uint32_t cell_index) {
+    statistics.deepest = std::max(statistics.deepest, cell_index);
+}
+
+FORCE_INLINE
+t_candidate_mark mark_candidate(t_board& board, uint32_t cell_index) {
+    auto& statistics = *board.candidate_statistics;
+    const t_candidate_mark mark = { board.total_placed_nodes, board.total_solutions, statistics.deepest };
+    statistics.deepest = cell_index + 1;
+    return mark;
+}
+
+FORCE_INLINE
+void record_candidate(t_board& board, const t_precalculated_piece& piece, const t_candidate_mark& mark) {
+    auto& statistics = *board.candidate_statistics;
+    auto& counts = statistics.counts[statistics.order->ids[&piece - statistics.order->base]];
+    const auto solutions = board.total_solutions - mark.solutions;
+    add_candidate_count(counts.placements, 1);
+    add_candidate_count(counts.nodes, board.total_placed_nodes - mark.placed_nodes);
+    add_candidate_count(counts.solutions, solutions);
+    add_candidate_count(counts.depth, solutions > 0 ? board.total_cells : statistics.deepest);
+    statistics.deepest = std::max(mark.deepest, statistics.deepest);
+}
+
+INLINE
+double candidate_score(const t_candidate_counts& counts, CANDIDATE_SCORE::CANDIDATE_SCORE score) {
+    if (score == CANDIDATE_SCORE::YIELD)
+        return counts.nodes > 0 ? static_cast<double>(counts.solutions) / static_cast<double>(counts.nodes) : 0.0;
+    return static_cast<double>(counts.depth) / static_cast<double>(counts.placements);
+}
+
+/// <summary>
+///  Copy 'source' into a new order, each list sorted by 'scores' ( per id, NaN for a candidate we know nothing
+///  about ). Without scores, or between candidates with the same score, the source order stays.
+/// </summary>
+INLINE
+t_candidate_order* create_candidate_order(const t_piece_matrix_vector& source, const t_candidate_order* source_order, const std::vector<double>* scores, t_arena& arena) {
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * source.cell_type_offset;
+    size_t positions = 0;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        if (source.pieces[i] != nullptr)
+            positions += CANDIDATE_LIST_HEADER + source.pieces[i]->size();
+    }
+    auto order = static_cast<t_candidate_order*>(arena_alloc(arena, sizeof(t_candidate_order), "candidate orders"));
+    auto matrix = static_cast<t_piece_matrix_vector*>(arena_alloc(arena, sizeof(t_piece_matrix_vector) + total_entries * sizeof(t_candidate_list*), "candidate orders"));
+    auto block = static_cast<t_precalculated_piece*>(arena_alloc(arena, std::max<size_t>(positions, 1) * sizeof(t_precalculated_piece), "candidate orders"));
+    auto ids = static_cast<uint32_t*>(arena_alloc(arena, std::max<size_t>(positions, 1) * sizeof(uint32_t), "candidate orders"));
+    if (order == nullptr || matrix == nullptr || block == nullptr || ids == nullptr)
+        return nullptr;
+    matrix->cell_type_offset = source.cell_type_offset;
+    matrix->stride = source.stride;
+
+    typedef struct {
+        double score;
+        t_precalculated_piece piece;
+        uint32_t id;
+    } t_entry;
+    std::vector<t_entry> entries;
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        const auto source_list = source.pieces[i];
+        if (source_list == nullptr) {
+            matrix->pieces[i] = nullptr;
+            continue;
+        }
+        entries.clear();
+        double known_total = 0;
+        uint32_t known = 0;
+        for (uint32_t k = 0; k < source_list->count; ++k) {
+            const auto& piece = source_list->pieces[k];
+            const auto id = source_order != nullptr ? source_order->ids[&piece - source_order->base] : position + CANDIDATE_LIST_HEADER + k;
+            const auto score = scores != nullptr ? (*scores)[id] : std::numeric_limits<double>::quiet_NaN();
+            if (!std::isnan(score)) {
+                known_total += score;
+                known++;
+            }
+            entries.push_back({ score, piece, id });
+        }
+        if (scores != nullptr) {
+            // The candidates we know nothing about keep their place among the average ones
+            const auto average = known > 0 ? known_total / known : 0.0;
+            for (auto& entry : entries) {
+                if (std::isnan(entry.score))
+                    entry.score = average;
+            }
+            std::stable_sort(entries.begin(), entries.end(), [](const t_entry& a, const t_entry& b) { return a.score > b.score; });
+        }
+
+        auto list = reinterpret_cast<t_candidate_list*>(block + position);
+        list->count = source_list->count;
+        list->reserved = 0;
+        for (uint32_t k = 0; k < list->count; ++k) {
+            list->pieces[k] = entries[k].piece;
+            ids[position + CANDIDATE_LIST_HEADER + k] = entries[k].id;
+        }
+        matrix->pieces[i] = list;
+        position += CANDIDATE_LIST_HEADER + list->count;
+    }
+
+    order->matrix = matrix;
+    order->base = block;
+    order->ids = ids;
+    return order;
+}
+
+INLINE
+t_candidate_ordering* create_candidate_ordering(const t_piece_matrix_vector& source, CANDIDATE_SCORE::CANDIDATE_SCORE score, t_arena& arena) {
+    const auto first = create_candidate_order(source, nullptr, nullptr, arena);
+    if (first == nullptr)
+        return nullptr;
+    auto ordering = new t_candidate_ordering();
+    ordering->score = score;
+    ordering->first = first;
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * source.cell_type_offset;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        if (source.pieces[i] != nullptr)
+            ordering->total_ids += CANDIDATE_LIST_HEADER + source.pieces[i]->count;
+    }
+    ordering->current = first;
+    ordering->prior.resize(ordering->total_ids);
+    return ordering;
+}
+
+// The counters of a new worker, its board starts with the current order
+INLINE
+t_candidate_statistics* add_candidate_statistics(t_candidate_ordering& ordering) {
+    const auto memory_size = sizeof(t_candidate_counts) * ordering.total_ids;
+    auto counts = static_cast<t_candidate_counts*>(alloc_aligned(memory_size, 64));
+    if (counts == nullptr)
+        return nullptr;
+    memset(counts, 0, memory_size);
+    auto statistics = new t_candidate_statistics{ .order = ordering.current.load(), .counts = counts, .deepest = 0 };
+    ordering.threads.push_back(statistics);
+    return statistics;
+}
+
+INLINE
+void free_candidate_ordering(t_candidate_ordering* ordering) {
+    if (ordering == nullptr)
+        return;
+    for (auto statistics : ordering->threads) {
+        free_aligned(statistics->counts);
+        delete statistics;
+    }
+    delete ordering;
+}
+
+// Switch the board to the latest order, only between two searches
+INLINE
+void adopt_candidate_order(t_board& board, const t_candidate_ordering& ordering) {
+    const auto order = ordering.current.load(std::memory_order_acquire);
+    if (board.candidate_statistics->order == order)
+        return;
+    board.candidate_statistics->order = order;
+    set_board_matrix(board, order->matrix);
+}
+
+// What the file had plus what every thread counted so far
+INLINE
+std::vector<t_candidate_counts> merge_candidate_counts(const t_candidate_ordering& ordering) {
+    auto merged = ordering.prior;
+    for (const auto statistics : ordering.threads) {
+        for (uint32_t id = 0; id < ordering.total_ids; ++id) {
+            auto& counts = statistics->counts[id];
+            merged[id].placements += load_candidate_count(counts.placements);
+            merged[id].nodes += load_candidate_count(counts.nodes);
+            merged[id].solutions += load_candidate_count(counts.solutions);
+            merged[id].depth += load_candidate_count(counts.depth);
+        }
+    }
+    return merged;
+}
+
+/// <summary>
+///  Build and publish a new order from the counters, once they grew enough since the last one. The order goes in
+///  the arena while the search runs, the caller has to be the only thread allocating from it ( see t_arena ).
+/// </summary>
+/// <returns>true if the workers have a new order to pick up</returns>
+INLINE
+bool reorder_candidates(t_candidate_ordering& ordering, t_arena& arena) {
+    const auto merged = merge_candidate_counts(ordering);
+    uint64_t placements = 0;
+    std::vector<double> scores(ordering.total_ids, std::numeric_limits<double>::quiet_NaN());
+    for (uint32_t id = 0; id < ordering.total_ids; ++id) {
+        placements += merged[id].placements;
+        if (merged[id].placements > 0)
+            scores[id] = candidate_score(merged[id], ordering.score);
+    }
+    if (placements == 0 || placements < ordering.last_placements * CANDIDATE_REORDER_GROWTH)
+        return false;
+    const auto current = ordering.current.load();
+    const auto order = create_candidate_order(*current->matrix, current, &scores, arena);
+    if (order == nullptr)
+        return false;
+    ordering.last_placements = placements;
+    ordering.reorders++;
+    ordering.current.store(order, std::memory_order_release);
+    return true;
+}
+
+/// <summary>
+///  The counters of every candidate as text, one line per candidate: slot, piece, rotation and the counters. The
+///  slot is the index in the piece matrix so the file only fits the puzzle it was written for, the first line
+///  says how large that matrix was.
+/// </summary>
+INLINE
+bool save_candidate_order(const t_candidate_ordering& ordering, const std::string& file_name) {
+    std::ofstream output(file_name);
+    if (!output.is_open())
+        return false;
+    const auto& matrix = *ordering.first->matrix;
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * matrix.cell_type_offset;
+    const auto merged = merge_candidate_counts(ordering);
+    output << e2::format("candidates {} {}\n", total_entries, ordering.total_ids);
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        const auto list = matrix.pieces[i];
+        if (list == nullptr)
+            continue;
+        for (const auto& piece : *list) {
+            const auto& counts = merged[ordering.first->ids[&piece - ordering.first->base]];
+            if (counts.placements == 0)
+                continue;
+            output << e2::format("{} {} {} {} {} {} {}\n", i, piece.identifier.index, piece.identifier.rotation,
+                counts.placements, counts.nodes, counts.solutions, counts.depth);
+        }
+    }
+    return output.good();
+}
+
+/// <summary>
+///  Load the counters of an earlier run and sort the lists by them right away
+/// </summary>
+/// <returns>false if the file could not be read or was written for another puzzle</returns>
+INLINE
+bool load_candidate_order(t_candidate_ordering& ordering, const std::string& file_name, t_arena& arena) {
+    std::ifstream input(file_name);
+    if (!input.is_open())
+        return false;
+    const auto& matrix = *ordering.first->matrix;
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * matrix.cell_type_offset;
+    std::string tag;
+    uint32_t file_entries = 0, file_ids = 0;
+    if (!(input >> tag >> file_entries >> file_ids) || tag != "candidates" || file_entries != total_entries || file_ids != ordering.total_ids)
+        return false;
+
+    // Slot, piece and rotation to the id of the candidate
+    std::unordered_map<uint64_t, uint32_t> ids;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        const auto list = matrix.pieces[i];
+        if (list == nullptr)
+            continue;
+        for (const auto& piece : *list) {
+            ids[(static_cast<uint64_t>(i) << 16) | (piece.identifier.index << 8) | piece.identifier.rotation] = ordering.first->ids[&piece - ordering.first->base];
+        }
+    }
+    uint64_t slot = 0, index = 0, rotation = 0;
+    t_candidate_counts counts = {};
+    while (input >> slot >> index >> rotation >> counts.placements >> counts.nodes >> counts.solutions >> counts.depth) {
+        const auto id = ids.find((slot << 16) | ((index & 0xFF) << 8) | (rotation & 0xFF));
+        if (id != ids.end())
+            ordering.prior[id->second] = counts;
+    }
+    reorder_candidates(ordering, arena);
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+
+#include "Common.h"
+
+/// <summary>
+///  Counters for one cell, since we fill the board row by row the cell index is also the search depth
+/// </summary>
+typedef struct st_cell_statistics {
+    // How many times we entered the cell
+    uint64_t visits;
+    // How many candidates we tested, checked / visits is the average candidate list length
+    uint64_t checked;
+    // How many pieces we placed
+    uint64_t placed;
+    // How many visits did not place anything
+    uint64_t dead_ends;
+} t_cell_statistics;
+
+/// <summary>
+///  Each thread gets its own array, aligned to a cache line so two threads never write to the same line
+/// </summary>
+INLINE
+t_cell_statistics* create_cell_statistics(uint32_t total_cells) {
+    const auto memory_size = sizeof(t_cell_statistics) * total_cells;
+    auto statistics = static_cast<t_cell_statistics*>(alloc_aligned(memory_size, 64));
+    if (statistics != nullptr) {
+        memset(statistics, 0, memory_size);
+    }
+    return statistics;
+}
+
+void free_cell_statistics(t_cell_statistics* statistics) {
+    if (statistics != nullptr)
+        free_aligned(statistics);
+}
+
+FORCE_INLINE
+void record_cell_visit(t_cell_statistics& statistics, uint64_t checked, uint64_t placed) {
+    statistics.visits++;
+    statistics.checked += checked;
+    statistics.placed += placed;
+    statistics.dead_ends += placed == 0 ? 1 : 0;
+}
+
+INLINE
+void merge_cell_statistics(t_cell_statistics* target, const t_cell_statistics* source, uint32_t total_cells) {
+    for (uint32_t idx = 0; idx < total_cells; ++idx) {
+        target[idx].visits += source[idx].visits;
+        target[idx].checked += source[idx].checked;
+        target[idx].placed += source[idx].placed;
+        target[idx].dead_ends += source[idx].dead_ends;
+    }
+}
+
+INLINE
+double average_candidates(const t_cell_statistics& statistics) {
+    return statistics.visits > 0 ? static_cast<double>(statistics.checked) / static_cast<double>(statistics.visits) : 0.0;
+}
+
+/// <summary>
+///  Write the counters as Width x Height grids, one grid per counter.
+///  A file name ending in '.json' gets a JSON object with one array of rows per counter, anything else gets CSV
+///  with a '# counter' line before each grid.
+/// </summary>
+INLINE
+bool write_cell_statistics(const std::string& file_name, const t_cell_statistics* statistics, uint32_t width, uint32_t height) {
+    std::ofstream output(file_name);
+    if (!output.is_open())
+        return false;
+
+    typedef struct {
+        const char* name;
+        std::string(*value)(const t_cell_statistics&);
+    } t_counter;
+    static const t_counter counters[] = {
+        { "visits", [](const t_cell_statistics& s) { return std::to_string(s.visits); } },
+        { "checked", [](const t_cell_statistics& s) { return std::to_string(s.checked); } },
+        { "placed", [](const t_cell_statistics& s) { return std::to_string(s.placed); } },
+        { "dead_ends", [](const t_cell_statistics& s) { return std::to_string(s.dead_ends); } },
+        { "average_candidates", [](const t_cell_statistics& s) { return e2::format("{:.3f}", average_candidates(s)); } },
+    };
+
+    const bool json = file_name.size() >= 5 && file_name.compare(file_name.size() - 5, 5, ".json") == 0;
+    if (json) {
+        output << e2::format("{{\n  \"width\": {},\n  \"height\": {}", width, height);
+        for (const auto& counter : counters) {
+            output << e2::format(",\n  \"{}\": [", counter.name);
+            for (uint32_t y = 0; y < height; ++y) {
+                output << (y == 0 ? "\n    [" : ",\n    [");
+                for (uint32_t x = 0; x < width; ++x) {
+                    output << (x == 0 ? "" : ", ") << counter.value(statistics[get_idx(x, y, width)]);
+                }
+                output << "]";
+            }
+            output << "\n  ]";
+        }
+        output << "\n}\n";
+    }
+    else {
+        for (const auto& counter : counters) {
+            output << "# " << counter.name << "\n";
+            for (uint32_t y = 0; y < height; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    output << (x == 0 ? "" : ",") << counter.value(statistics[get_idx(x, y, width)]);
+                }
+                output << "\n";
+            }
+        }
+    }
+    return output.good();
+}
@@ -3,19 +3,61 @@
 #include <chrono>
 #include <vector>
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <array>
-#include <format>
+#include <thread>
+#include "FormatCompat.h"
 
 #define RETURN_ERR -1
 #define RETURN_OK   0
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+
 #define PACK( __Declaration__ ) __pragma( pack(push, 1) ) __Declaration__ __pragma( pack(pop))
 #define INLINE __inline
 #define FORCE_INLINE __forceinline
 #define ALIGN(nr) __declspec(align((nr)))
 #define REGISTER register
+// Functions that use a wider instruction set than the baseline, they are only called after a cpuid check
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+
+#define PACK( __Declaration__ ) __Declaration__ __attribute__((packed))
+#define INLINE inline
+#define FORCE_INLINE inline __attribute__((always_inline))
+#define ALIGN(nr) __attribute__((aligned(nr)))
+// 'register' is gone since C++17, only MSVC still accepts it
+#define REGISTER
+// GCC and Clang only emit the wider instructions in functions that ask for them
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f")))
+#endif
+
+// Aligned heap memory, released with free_aligned. Outside MSVC the size is rounded up since aligned_alloc wants a
+// multiple of the alignment.
+INLINE
+void* alloc_aligned(size_t size, size_t alignment) {
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+INLINE
+void free_aligned(void* memory) {
+#if defined(_MSC_VER)
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
 
 typedef uint8_t     color_t;
 constexpr auto      EDGE_COLOR = 0;
@@ -49,6 +91,19 @@ namespace CELL_TYPE {
     };
 }
 
+// Hardware counters collected around the search ( see PerfCounters.h )
+namespace PERF_EVENT {
+    enum PERF_EVENT : uint8_t {
+        INSTRUCTIONS = 0,
+        CYCLES,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        LLC_MISSES,
+        DTLB_MISSES,
+        MAX = DTLB_MISSES + 1
+    };
+}
+
 typedef struct {
     uint8_t idx;
     PIECE_TYPE::PIECE_TYPE flags;
@@ -70,7 +125,7 @@ typedef PACK(struct {
     uint8_t rotation;
 }) t_piece_identifier;
 
-typedef PACK(ALIGN(4) struct {
+typedef PACK(struct ALIGN(4) {
     // The right color that we have to use, this contains offsets into a piece array ( it's not just the color )
     uint32_t right;
     // Bottom color
@@ -81,29 +136,61 @@ typedef PACK(ALIGN(4) struct {
 
 typedef std::vector<t_precalculated_piece> t_piece_vector;
 
-typedef PACK(ALIGN(32) struct
+// The candidates of one slot of the piece matrix, the pieces follow the count in memory so reading a slot touches a
+// single run of bytes
+typedef struct {
+    uint32_t count;
+    // Keeps the pieces 8 byte aligned
+    uint32_t reserved;
+    t_precalculated_piece pieces[];
+
+    // So the search can loop over a list like over a vector
+    const t_precalculated_piece* begin() const { return pieces; }
+    const t_precalculated_piece* end() const { return pieces + count; }
+    const t_precalculated_piece* data() const { return pieces; }
+    size_t size() const { return count; }
+} t_candidate_list;
+
+// A board cell, the neighbors are implicit
+//  - The cell to the right is the next one. On the right border that is the first cell of the next row, but every
+//    piece that fits a right border cell has EDGE_COLOR on its right, which is the left color the first column needs.
+//  - The cell bellow is one row further. The board has one extra row of padding cells that takes the bottom colors of
+//    the last row, nothing ever reads them.
+typedef PACK(struct
 {
-    // A pointer to the matrix containing all possible "LEFT / TOP" vector combinations for this cell type
-    t_piece_vector** pieces;
-    // Obvious
-    t_piece_identifier identifier;
+    // Left color, premultiplied by the color stride of the piece matrix like 't_precalculated_piece::right'
+    uint16_t left_color;
     // Obvious
-    uint32_t top_color;
-    // Obvious
-    uint32_t left_color;
-    // Offset in the board cell array to the cell bellow this one
-    uint32_t bottom_cell_offset;
-    // Offset in the board cell array to the cell to the left of this one
-    uint32_t right_cell_offset;
-    // The board has 1 extra cell
-    //  All the cells on the "RIGHT" border have their "right_offsets" set to the dummy cell, since the cells do not actually have a right neighbor
-    //      that means we eliminate a check for the right border
-    //  All the cells on the BOTTOM border have their "bottom_offsets" set to the dummy cell, since the cells do not actually have a bottom neighbor
-    //      that means we eliminate a check for the bottom border
+    color_t top_color;
+    // Cell type, picks the piece matrix the cell takes its candidates from
+    uint8_t type;
 }) t_cell;
+static_assert(sizeof(t_cell) == 4, "Board cells are expected to be 4 bytes");
+
+// Most cells a work unit can fill, enough to split any board we can load into more units than we could search
+constexpr uint32_t MAX_WORK_UNIT_DEPTH = 13;
+// Most work units one thread can search at the same time ( see InterleavedBacktracker.h )
+constexpr uint32_t MAX_INTERLEAVED_LANES = 8;
+
+// A work unit, the pieces of the first cells of the board. The worker looks the colors up again in the candidate
+// lists, so a unit is a small fixed size record that can be queued by the million, written to disk or sent away.
+typedef PACK(struct {
+    // Position in the generation order, the same puzzle split at the same depth always gives the same ids
+    uint32_t id;
+    // Number of cells filled by the unit
+    uint8_t depth;
+    uint8_t reserved;
+    t_piece_identifier pieces[MAX_WORK_UNIT_DEPTH];
+}) t_work_unit;
+static_assert(sizeof(t_work_unit) == 32, "Work units are expected to be 32 bytes");
+// Start cell of a work unit that does not fit the board
+constexpr uint32_t WORK_UNIT_INVALID = UINT32_MAX;
 
 // Forward declaration
 struct st_board;
+struct st_cell_statistics;
+struct st_candidate_statistics;
+struct st_search_position;
 // Define a callback used for processing solutions
 typedef void(*t_solution_callback)(struct st_board& board);
 // Finally the board definition
@@ -111,11 +198,19 @@ typedef PACK(struct st_board
 {
     void* user_data; // Pointer to user data, can be used for additional information
     t_solution_callback solution_callback;
+    // Per cell counters, only collected when this is set
+    struct st_cell_statistics* cell_statistics;
+    // Per candidate counters of the adaptive order ( see CandidateOrder.h ), only read by its search policy
+    struct st_candidate_statistics* candidate_statistics;
+    // Where the search of the current work unit is, published for the progress estimate ( see SearchEstimate.h )
+    // while the search is above 'position_end'
+    struct st_search_position* search_position;
+    uint32_t position_end;
     // Basically the Width of the puzzle
     uint32_t cells_stride;
     // Total number of cells in the board
     uint32_t total_cells;
-    // The actual number of cells we have allocated for the board, this is Width * Height + 1 ( dummy cell )
+    // The actual number of cells we have allocated for the board, this is Width * ( Height + 1 ) ( padding row )
     uint32_t actual_total_cells;
     // Max depth reached
     uint32_t max_depth;
@@ -125,9 +220,20 @@ typedef PACK(struct st_board
     uint64_t total_placed_nodes;
     // Total number of solutions
     uint64_t total_solutions;
+    // The search stops once it placed that many nodes, a run of the restarting search ( see RestartSearch.h ) or
+    // a share of --max-nodes it tops up from the run control
+    uint64_t node_budget;
+    // Set from other threads to stop or pause the search ( see RunControl.h ), go through board_done and
+    // set_board_done for that
     bool done;
     // Used piece bitmask
     bool used_pieces[256];
+    // The candidate slots of each cell type, indexed by 'left_color + top_color'
+    const t_candidate_list* const* cell_type_slots[CELL_TYPE::MAX];
+    // The pieces on the board, one per cell, kept apart from the cells so the search only touches the colors
+    t_piece_identifier* identifiers;
+    // Copy of the identifiers of the deepest board we reached
+    t_piece_identifier* best_identifiers;
     // Board cells
     t_cell cells[];
 }) t_board;
@@ -137,10 +243,16 @@ typedef struct {
     // We have 
     uint32_t cell_type_offset;
     uint32_t stride;
-    // Contains a list of "CELL_TYPE::MAX" matrices of X * X with pointer to vectors of pieces form COLOR_1 to COLOR_2
-    t_piece_vector* pieces[];
+    // Contains a list of "CELL_TYPE::MAX" matrices of X * X with pointer to lists of pieces form COLOR_1 to COLOR_2
+    const t_candidate_list* pieces[];
 } t_piece_matrix_vector;
 
+typedef struct {
+    uint64_t values[PERF_EVENT::MAX];
+    // Bit N is set if event N was counted
+    uint32_t valid;
+} t_perf_values;
+
 typedef struct {
     std::atomic<uint64_t> total_solutions;
     std::atomic<uint64_t> total_nodes_placed;
@@ -149,6 +261,14 @@ typedef struct {
     std::chrono::high_resolution_clock::time_point end_time;
     uint64_t start_clock_cycles;
     uint64_t end_clock_cycles;
+    t_perf_values perf;
+    // Time spent before the search: loading the puzzle, building the tables and work unit roots, and from the
+    // start of the search until the first work unit was queued
+    std::chrono::nanoseconds load_time = {};
+    std::chrono::nanoseconds setup_time = {};
+    std::chrono::nanoseconds first_unit_time = {};
+    // From the request to stop early ( first solution, limits, signals ) until every worker returned
+    std::chrono::nanoseconds stop_latency = {};
 } t_statistics_data;
 
 std::string format_duration(std::chrono::nanoseconds nanoseconds) {
@@ -158,7 +278,14 @@ std::string format_duration(std::chrono::nanoseconds nanoseconds) {
     const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(nanoseconds - hrs - mins - secs);
     const auto us = std::chrono::duration_cast<std::chrono::microseconds>(nanoseconds - hrs - mins - secs - ms);
     const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(nanoseconds - hrs - mins - secs - ms - us);
-    return std::format("{}:{}:{} ({}.{}.{})", hrs, mins, secs, ms, us, ns);
+    return e2::format("{}:{}:{} ({}.{}.{})", hrs, mins, secs, ms, us, ns);
+}
+
+// We keep one core for the reporting thread, unless there is only one
+INLINE
+uint32_t available_worker_threads() {
+    const auto hardware_threads = std::thread::hardware_concurrency();
+    return hardware_threads > 1 ? hardware_threads - 1 : 1;
 }
 
 FORCE_INLINE
@@ -169,11 +296,11 @@ uint32_t get_idx(uint32_t x, uint32_t y, uint32_t width) {
 // Why not mix a little bit of "class" action
 typedef struct timed_block
 {
-    explicit timed_block(std::string message) : m_start(std::chrono::high_resolution_clock::now()), m_message(std::move(message)) {}
+    explicit timed_block(std::string message) : m_start(std::chrono::steady_clock::now()), m_message(std::move(message)) {}
     ~timed_block()
     {
-        const auto total = std::chrono::high_resolution_clock::now() - m_start;
-        std::cout << std::format("{}: {}\n", m_message, format_duration(total));
+        const auto total = std::chrono::steady_clock::now() - m_start;
+        std::cout << e2::format("{}: {}\n", m_message, format_duration(total));
     }
     std::chrono::steady_clock::time_point m_start;
     std::string m_message;
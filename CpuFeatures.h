@@ -0,0 +1,108 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "Common.h"
+#include "CandidateFilter.h"
+
+typedef struct {
+    bool avx2;
+    bool avx512;
+} t_cpu_features;
+
+INLINE
+void read_cpuid(int registers[4], int leaf, int subleaf) {
+#if defined(_MSC_VER)
+    __cpuidex(registers, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Which register states the OS saves on a context switch
+INLINE
+uint64_t read_xcr0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    // The _xgetbv intrinsic needs the xsave target on GCC, the instruction itself is always there once OSXSAVE is set
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+/// <summary>
+///  Query cpuid for the instruction sets the kernels need, the OS also has to save the wider registers
+///  on a context switch ( XCR0 ) otherwise we can not use them even if the CPU has them.
+/// </summary>
+INLINE
+t_cpu_features detect_cpu_features() {
+    t_cpu_features features = {};
+
+    int registers[4] = {};
+    read_cpuid(registers, 0, 0);
+    const auto max_leaf = registers[0];
+    if (max_leaf < 7)
+        return features;
+
+    read_cpuid(registers, 1, 0);
+    const bool os_xsave = (registers[2] & (1 << 27)) != 0;
+    const bool avx = (registers[2] & (1 << 28)) != 0;
+    if (!os_xsave || !avx)
+        return features;
+
+    const auto xcr0 = read_xcr0();
+    // SSE and AVX state
+    const bool os_avx = (xcr0 & 0x6) == 0x6;
+    // Opmask, upper half of ZMM0-15 and ZMM16-31 state
+    const bool os_avx512 = (xcr0 & 0xE6) == 0xE6;
+
+    read_cpuid(registers, 7, 0);
+    features.avx2 = os_avx && (registers[1] & (1 << 5)) != 0;
+    features.avx512 = os_avx512 && features.avx2 && (registers[1] & (1 << 16)) != 0;
+    return features;
+}
+
+INLINE
+KERNEL_ISA::KERNEL_ISA best_kernel_isa(const t_cpu_features& features) {
+    if (features.avx512)
+        return KERNEL_ISA::AVX512;
+    if (features.avx2)
+        return KERNEL_ISA::AVX2;
+    return KERNEL_ISA::SCALAR;
+}
+
+INLINE
+bool is_kernel_isa_supported(const t_cpu_features& features, KERNEL_ISA::KERNEL_ISA isa) {
+    switch (isa) {
+    case KERNEL_ISA::AVX512:
+        return features.avx512;
+    case KERNEL_ISA::AVX2:
+        return features.avx2;
+    default:
+        return true;
+    }
+}
+
+INLINE
+const char* kernel_isa_name(KERNEL_ISA::KERNEL_ISA isa) {
+    switch (isa) {
+    case KERNEL_ISA::AVX512:
+        return "avx512";
+    case KERNEL_ISA::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+INLINE
+std::optional<KERNEL_ISA::KERNEL_ISA> parse_kernel_isa(const std::string& name) {
+    for (uint8_t isa = 0; isa < KERNEL_ISA::MAX; ++isa) {
+        if (name == kernel_isa_name(static_cast<KERNEL_ISA::KERNEL_ISA>(isa)))
+            return static_cast<KERNEL_ISA::KERNEL_ISA>(isa);
+    }
+    return std::nullopt;
+}
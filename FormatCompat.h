@@ -0,0 +1,20 @@
+#pragma once
+
+// Standard libraries without <format> ( GCC 12, older libc++ ) get {fmt} instead, the build only defines
+// E2_FORMAT_FMT when it could not find <format>. The code formats through e2::format and specializes
+// E2_FORMAT_NAMESPACE::formatter, so nothing is ever added to namespace std.
+#if defined(E2_FORMAT_FMT)
+#include <fmt/format.h>
+#include <fmt/chrono.h>
+#define E2_FORMAT_NAMESPACE fmt
+#else
+#include <format>
+#define E2_FORMAT_NAMESPACE std
+#endif
+
+namespace e2 {
+    using E2_FORMAT_NAMESPACE::format;
+    using E2_FORMAT_NAMESPACE::format_to;
+    using E2_FORMAT_NAMESPACE::format_context;
+    using E2_FORMAT_NAMESPACE::format_parse_context;
+}
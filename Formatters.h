@@ -1,4 +1,5 @@
 #pragma once
+#include <cmath>
 #include <thread>
 
 #include "Common.h"
@@ -6,30 +7,30 @@
 
 // Custom formatter for the identifier block
 template<>
-struct std::formatter<t_piece_identifier> {
+struct E2_FORMAT_NAMESPACE::formatter<t_piece_identifier> {
 
-    constexpr auto parse(std::format_parse_context& ctx) {
+    constexpr auto parse(e2::format_parse_context& ctx) {
         return ctx.begin();
     }
 
-    auto format(const t_piece_identifier& identifier, std::format_context& ctx) const {
-        return std::format_to(ctx.out(), "{:3}({})", identifier.index, identifier.rotation);
+    auto format(const t_piece_identifier& identifier, e2::format_context& ctx) const {
+        return e2::format_to(ctx.out(), "{:3}({})", identifier.index, identifier.rotation);
     };
 };
 
 
 // Custom formatter for thread id
 template<>
-struct std::formatter<std::thread::id> {
+struct E2_FORMAT_NAMESPACE::formatter<std::thread::id> {
 
-    constexpr auto parse(std::format_parse_context& ctx) {
+    constexpr auto parse(e2::format_parse_context& ctx) {
         return ctx.begin();
     }
 
-    auto format(const std::thread::id& identifier, std::format_context& ctx) const {
+    auto format(const std::thread::id& identifier, e2::format_context& ctx) const {
         std::ostringstream ss;
         ss << identifier;
-        return std::format_to(ctx.out(), "{:5}", ss.str());
+        return e2::format_to(ctx.out(), "{:5}", ss.str());
     };
 };
 
@@ -37,10 +38,25 @@ std::string format_number_human_readable(int64_t number) {
     if (number < 1000)
         return std::to_string(number);
     if (number < 1'000'000)
-        return std::format("{:6.2f}K", static_cast<double>(number) / 1'000.0);
+        return e2::format("{:6.2f}K", static_cast<double>(number) / 1'000.0);
     if (number < 1'000'000'000)
-        return std::format("{:6.2f}M", static_cast<double>(number) / 1'000'000.0);
+        return e2::format("{:6.2f}M", static_cast<double>(number) / 1'000'000.0);
     if (number < 1'000'000'000'000)
-        return std::format("{:6.2f}B", static_cast<double>(number) / 1'000'000'000.0);
-    return std::format("{:6.2f}T", static_cast<double>(number) / 1'000'000'000'000.0);
-}
\ No newline at end of file
+        return e2::format("{:6.2f}B", static_cast<double>(number) / 1'000'000'000.0);
+    return e2::format("{:6.2f}T", static_cast<double>(number) / 1'000'000'000'000.0);
+}
+
+// Rough time left, from seconds up to years
+std::string format_eta(double seconds) {
+    if (!std::isfinite(seconds))
+        return "forever";
+    if (seconds < 60)
+        return e2::format("{:.0f}s", seconds);
+    if (seconds < 3600)
+        return e2::format("{:.1f}m", seconds / 60);
+    if (seconds < 86400)
+        return e2::format("{:.1f}h", seconds / 3600);
+    if (seconds < 365.25 * 86400)
+        return e2::format("{:.1f}d", seconds / 86400);
+    return e2::format("{:.3g}y", seconds / (365.25 * 86400));
+}
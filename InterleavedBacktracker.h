@@ -0,0 +1,180 @@
+#pragma once
+
+#include <immintrin.h>
+#include <memory>
+
+#include "Common.h"
+#include "Board.h"
+#include "RunControl.h"
+
+namespace FRAME_STATE {
+    enum FRAME_STATE : uint8_t {
+        // We loaded the slot pointer, the vector header was prefetched
+        VECTOR = 0,
+        // We know the candidates, they were prefetched, we can start checking them
+        READY
+    };
+}
+
+/// <summary>
+///  One level of the explicit search stack, this is what the recursion keeps on the call stack in 'backtrack'
+/// </summary>
+typedef struct {
+    const t_candidate_list* pieces;
+    const t_precalculated_piece* candidates;
+    uint32_t count;
+    // Next candidate to check
+    uint32_t position;
+    // The piece we placed from this level and have to release before trying the next candidate
+    int16_t placed_piece;
+    FRAME_STATE::FRAME_STATE state;
+} t_search_frame;
+
+/// <summary>
+///  An independent depth first search over one work unit, with its own board and stack
+/// </summary>
+typedef struct {
+    t_board* board;
+    // One frame for each cell, index by cell index
+    t_search_frame* stack;
+    // The first cell we are allowed to change, everything before it comes from the work unit
+    uint32_t start_index;
+    // Cell index of the top frame
+    uint32_t depth;
+    bool active;
+} t_search_lane;
+
+/// <summary>
+///  A single thread advances several lanes round robin, one node at a time. While one lane waits for its next
+///  candidate list to arrive in the cache the other lanes do useful work, a plain depth first search would just
+///  stall on the chain cell -> slot -> vector -> candidates.
+/// </summary>
+typedef struct {
+    uint32_t lane_count;
+    t_search_lane lanes[MAX_INTERLEAVED_LANES];
+} t_interleaved_search;
+
+INLINE
+t_interleaved_search* create_interleaved_search(
+    const std::shared_ptr<t_PuzzleData>& puzzle_data,
+    t_piece_matrix_vector* piece_matrix_vector,
+    const t_board& main_board,
+    uint32_t lane_count,
+    t_arena& arena)
+{
+    auto search = new t_interleaved_search();
+    search->lane_count = std::clamp<uint32_t>(lane_count, 1, MAX_INTERLEAVED_LANES);
+    for (uint32_t idx = 0; idx < search->lane_count; ++idx) {
+        auto& lane = search->lanes[idx];
+        lane.board = create_board(puzzle_data, piece_matrix_vector, arena);
+        lane.board->user_data = main_board.user_data;
+        lane.board->solution_callback = main_board.solution_callback;
+        lane.stack = arena_alloc_array<t_search_frame>(arena, lane.board->total_cells + 1, "search stacks");
+        lane.active = false;
+    }
+    return search;
+}
+
+// The boards and the stacks of the lanes belong to the arena
+void free_interleaved_search(t_interleaved_search* search) {
+    delete search;
+}
+
+/// <summary>
+///  Enter a cell, returns false if there is nothing to search in it ( solution or dead cell )
+/// </summary>
+FORCE_INLINE
+bool lane_enter_cell(t_search_lane& lane, t_board& stats_board, uint32_t cell_index) {
+    auto& board = *lane.board;
+    if (board.max_depth < cell_index) {
+        [[unlikely]]
+        board.max_depth = cell_index;
+        copy_cells(board);
+        if (stats_board.max_depth < cell_index)
+            stats_board.max_depth = cell_index;
+    }
+
+    if (cell_index == board.total_cells) {
+        [[unlikely]]
+        board.max_depth = cell_index;
+        stats_board.total_solutions++;
+        board.solution_callback(board);
+        return false;
+    }
+
+    // The slot table is small and hot, read it now and only prefetch the vector, we will read it on our next turn
+    const auto pieces = get_cell_candidates(board, cell_index);
+    if (pieces == nullptr)
+        return false;
+
+    auto& frame = lane.stack[cell_index];
+    frame.pieces = pieces;
+    frame.position = 0;
+    frame.placed_piece = -1;
+    frame.state = FRAME_STATE::VECTOR;
+    _mm_prefetch(reinterpret_cast<const char*>(pieces), _MM_HINT_T0);
+    lane.depth = cell_index;
+    return true;
+}
+
+/// <summary>
+///  Start searching a work unit, the hint pieces are already on the lane board
+/// </summary>
+INLINE
+void lane_start(t_search_lane& lane, t_board& stats_board, uint32_t start_index) {
+    lane.start_index = start_index;
+    lane.active = lane_enter_cell(lane, stats_board, start_index);
+}
+
+/// <summary>
+///  Advance the lane by one step, either the prefetch stage of a new cell or up to the next piece that opens a new cell.
+///  Finished levels are popped in the same step, there is nothing to wait for there since the parent is still hot.
+/// </summary>
+INLINE
+void lane_step(t_search_lane& lane, t_board& stats_board) {
+    auto& board = *lane.board;
+    auto* frame = &lane.stack[lane.depth];
+
+    if (frame->state == FRAME_STATE::VECTOR) {
+        frame->candidates = frame->pieces->data();
+        frame->count = static_cast<uint32_t>(frame->pieces->size());
+        _mm_prefetch(reinterpret_cast<const char*>(frame->candidates), _MM_HINT_T0);
+        frame->state = FRAME_STATE::READY;
+        return;
+    }
+
+    for (;;) {
+        // Release the piece we placed the last time we were on this level
+        if (frame->placed_piece >= 0) {
+            board.used_pieces[frame->placed_piece] = false;
+            frame->placed_piece = -1;
+        }
+
+        while (frame->position < frame->count && !board_stopped(stats_board)) {
+            const auto& piece = frame->candidates[frame->position++];
+            stats_board.total_checked_nodes++;
+
+            if (board.used_pieces[piece.identifier.index])
+                continue; // Piece already used
+
+            stats_board.total_placed_nodes++;
+
+            place_piece(board, lane.depth, piece);
+            board.used_pieces[piece.identifier.index] = true;
+
+            if (lane_enter_cell(lane, stats_board, lane.depth + 1)) {
+                // Remember what to release when we come back, the child runs on the next turn
+                frame->placed_piece = piece.identifier.index;
+                return;
+            }
+            board.used_pieces[piece.identifier.index] = false;
+        }
+
+        // Nothing left on this level, go back to the parent
+        if (lane.depth == lane.start_index) {
+            lane.active = false;
+            return;
+        }
+        frame = &lane.stack[--lane.depth];
+    }
+}
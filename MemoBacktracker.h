@@ -0,0 +1,144 @@
+#pragma once
+
+#include "Common.h"
+#include "Board.h"
+#include "RunControl.h"
+#include "TranspositionTable.h"
+
+/// <summary>
+///  Counting only backtracker that memoizes the number of solutions of a "suffix" subproblem.
+///  When we are about to fill cell N ( scan order is row by row ) everything that matters for the rest of the board is
+///   - the left color of cell N
+///   - the top colors of cells N .. N + Width - 1 ( the exposed frontier )
+///   - the set of pieces we already used
+///  Two different prefixes that end in the same state have the exact same number of completions, so we count it once
+///  and reuse it from a table that is shared between all the threads.
+///  Since a hit skips the whole subtree, no solution callback is called, this is only useful for counting.
+/// </summary>
+typedef struct {
+    t_transposition_table* table;
+    // Random keys for each piece, the used piece set hash is the XOR of the keys of the used pieces
+    uint64_t piece_keys[256];
+    // Hash of the current used piece set, maintained incrementally
+    uint64_t used_pieces_key;
+    // We only memoize subtrees that have at least this many cells left, the small ones are cheaper to recount
+    uint32_t min_remaining_cells;
+    // Some statistics
+    uint64_t probes;
+    uint64_t hits;
+    uint64_t stores;
+} t_memo_context;
+
+FORCE_INLINE
+uint64_t memo_mix(uint64_t value) {
+    // splitmix64 finalizer
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+INLINE
+t_memo_context* create_memo_context(t_transposition_table* table, const t_board& board) {
+    auto context = new t_memo_context();
+    context->table = table;
+    // Same keys for all the threads, otherwise they can not share entries
+    for (uint64_t idx = 0; idx < 256; ++idx) {
+        context->piece_keys[idx] = memo_mix(idx);
+    }
+    context->min_remaining_cells = board.cells_stride;
+    return context;
+}
+
+/// <summary>
+///  Recalculate the used pieces hash from the board, called every time we start a new set of hint pieces
+/// </summary>
+INLINE
+void memo_reset(t_memo_context& context, const t_board& board) {
+    context.used_pieces_key = 0;
+    for (uint32_t idx = 0; idx < 256; ++idx) {
+        if (board.used_pieces[idx])
+            context.used_pieces_key ^= context.piece_keys[idx];
+    }
+}
+
+FORCE_INLINE
+uint64_t memo_key(const t_memo_context& context, const t_board& board, uint32_t cell_index) {
+    const auto& cell = board.cells[cell_index];
+    auto key = memo_mix(context.used_pieces_key ^ cell_index);
+    key = memo_mix(key ^ cell.left_color);
+    // The frontier, the top colors from the current cell up to one full row ahead
+    const auto frontier_end = std::min(cell_index + board.cells_stride, board.total_cells);
+    for (uint32_t idx = cell_index; idx < frontier_end; ++idx) {
+        key = memo_mix(key ^ board.cells[idx].top_color);
+    }
+    // Zero is what an empty slot looks like
+    return key | 1;
+}
+
+/// <summary>
+///  Count all the solutions from the cell index onward, the total is also added to the board statistics
+/// </summary>
+/// <returns>Number of solutions in the subtree</returns>
+INLINE
+uint64_t backtrack_memo(t_memo_context& context, t_board& board, uint32_t cell_index) {
+    // Keep track of the maximum depth we reached in the backtracking and store the current state
+    if (board.max_depth < cell_index) {
+        [[unlikely]]
+        board.max_depth = cell_index;
+        copy_cells(board);
+    }
+
+    if (cell_index == board.total_cells) {
+        [[unlikely]]
+        board.total_solutions++;
+        return 1;
+    }
+
+    const auto pieces = get_cell_candidates(board, cell_index);
+    if (pieces == nullptr || board_stopped(board))
+        return 0;
+
+    const auto remaining_cells = board.total_cells - cell_index;
+    const bool memoize = remaining_cells >= context.min_remaining_cells;
+    uint64_t key = 0;
+    if (memoize) {
+        key = memo_key(context, board, cell_index);
+        uint64_t count = 0;
+        context.probes++;
+        if (tt_probe(*context.table, key, count)) {
+            // Already counted, the solutions of this subtree were not counted on this path so add them now
+            context.hits++;
+            board.total_solutions += count;
+            return count;
+        }
+    }
+
+    uint64_t solutions = 0;
+    for (const auto& piece : *pieces)
+    {
+        board.total_checked_nodes++;
+
+        if (board.used_pieces[piece.identifier.index])
+            continue; // Piece already used
+
+        board.total_placed_nodes++;
+
+        place_piece(board, cell_index, piece);
+
+        board.used_pieces[piece.identifier.index] = true;
+        context.used_pieces_key ^= context.piece_keys[piece.identifier.index];
+
+        solutions += backtrack_memo(context, board, cell_index + 1);
+
+        context.used_pieces_key ^= context.piece_keys[piece.identifier.index];
+        board.used_pieces[piece.identifier.index] = false;
+    }
+
+    // A stopped search has an incomplete count, do not poison the table with it
+    if (memoize && !board_done(board)) {
+        context.stores++;
+        tt_store(*context.table, key, solutions, remaining_cells);
+    }
+    return solutions;
+}
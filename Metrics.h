@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+// winsock2.h has to come before anything that pulls in windows.h without WIN32_LEAN_AND_MEAN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "Common.h"
+
+#if defined(_WIN32)
+typedef SOCKET t_socket;
+constexpr t_socket NO_SOCKET = INVALID_SOCKET;
+
+INLINE
+void close_socket(t_socket socket) {
+    closesocket(socket);
+}
+
+// Windows has no SIGPIPE to suppress
+constexpr int SEND_FLAGS = 0;
+
+INLINE
+bool wait_for_socket(t_socket socket, int timeout_ms) {
+    WSAPOLLFD descriptor = { socket, POLLRDNORM, 0 };
+    return WSAPoll(&descriptor, 1, timeout_ms) > 0;
+}
+#else
+typedef int t_socket;
+constexpr t_socket NO_SOCKET = -1;
+
+INLINE
+void close_socket(t_socket socket) {
+    close(socket);
+}
+
+// A client that hangs up early must not kill the solver with SIGPIPE
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+
+INLINE
+bool wait_for_socket(t_socket socket, int timeout_ms) {
+    pollfd descriptor = { socket, POLLIN, 0 };
+    return poll(&descriptor, 1, timeout_ms) > 0;
+}
+#endif
+
+// What one worker did so far
+typedef struct {
+    uint64_t placed;
+    uint64_t checked;
+    uint64_t solutions;
+    uint32_t max_depth;
+    bool running;
+} t_worker_metrics;
+
+/// <summary>
+///  Everything the reporting thread aggregated in one pass, the server only ever sees this
+/// </summary>
+typedef struct {
+    std::vector<t_worker_metrics> workers;
+    uint64_t queue_depth;
+    uint64_t generated_units;
+    uint32_t total_cells;
+    // The node series are left out when the search did not count them ( throughput profile )
+    bool nodes_counted;
+    double placed_per_second;
+    double checked_per_second;
+    // Only when the work units are estimated, see SearchEstimate.h
+    std::optional<double> explored;
+    std::optional<double> eta_seconds;
+} t_metrics_snapshot;
+
+/// <summary>
+///  Minimal HTTP server on localhost for Prometheus. The reporter renders the page once per report and swaps it in,
+///  a scrape only copies that string, so a slow or stuck client can hold up the server thread but never a worker.
+/// </summary>
+typedef struct {
+    t_socket listen_socket;
+    std::mutex mutex;
+    std::string page;
+    std::atomic<bool> stop;
+    std::thread thread;
+} t_metrics_server;
+
+INLINE
+std::string render_metrics(const t_metrics_snapshot& snapshot) {
+    std::string page;
+    const auto metric = [&page](const char* name, const char* type, const char* help) {
+        page += e2::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    };
+
+    uint64_t placed = 0;
+    uint64_t checked = 0;
+    uint64_t solutions = 0;
+    uint32_t best_depth = 0;
+    uint32_t running = 0;
+    for (const auto& worker : snapshot.workers) {
+        placed += worker.placed;
+        checked += worker.checked;
+        solutions += worker.solutions;
+        best_depth = std::max(best_depth, worker.max_depth);
+        running += worker.running ? 1 : 0;
+    }
+
+    if (snapshot.nodes_counted) {
+        metric("e2_placed_nodes_total", "counter", "Pieces placed by the search");
+        page += e2::format("e2_placed_nodes_total {}\n", placed);
+        metric("e2_worker_placed_nodes_total", "counter", "Pieces placed by each worker");
+        for (size_t idx = 0; idx < snapshot.workers.size(); ++idx) {
+            page += e2::format("e2_worker_placed_nodes_total{{thread=\"{}\"}} {}\n", idx, snapshot.workers[idx].placed);
+        }
+        metric("e2_checked_nodes_total", "counter", "Candidate pieces tested by the search");
+        page += e2::format("e2_checked_nodes_total {}\n", checked);
+        metric("e2_worker_checked_nodes_total", "counter", "Candidate pieces tested by each worker");
+        for (size_t idx = 0; idx < snapshot.workers.size(); ++idx) {
+            page += e2::format("e2_worker_checked_nodes_total{{thread=\"{}\"}} {}\n", idx, snapshot.workers[idx].checked);
+        }
+    }
+    metric("e2_solutions_total", "counter", "Solutions found");
+    page += e2::format("e2_solutions_total {}\n", solutions);
+    metric("e2_worker_solutions_total", "counter", "Solutions found by each worker");
+    for (size_t idx = 0; idx < snapshot.workers.size(); ++idx) {
+        page += e2::format("e2_worker_solutions_total{{thread=\"{}\"}} {}\n", idx, snapshot.workers[idx].solutions);
+    }
+    metric("e2_worker_max_depth", "gauge", "Deepest cell a worker reached");
+    for (size_t idx = 0; idx < snapshot.workers.size(); ++idx) {
+        page += e2::format("e2_worker_max_depth{{thread=\"{}\"}} {}\n", idx, snapshot.workers[idx].max_depth);
+    }
+    metric("e2_worker_running", "gauge", "1 while the worker is searching");
+    for (size_t idx = 0; idx < snapshot.workers.size(); ++idx) {
+        page += e2::format("e2_worker_running{{thread=\"{}\"}} {}\n", idx, snapshot.workers[idx].running ? 1 : 0);
+    }
+    metric("e2_best_score", "gauge", "Most pieces placed on one board");
+    page += e2::format("e2_best_score {}\n", best_depth);
+    metric("e2_board_cells", "gauge", "Cells on the board, the score of a solution");
+    page += e2::format("e2_board_cells {}\n", snapshot.total_cells);
+    metric("e2_running_workers", "gauge", "Workers still searching");
+    page += e2::format("e2_running_workers {}\n", running);
+    metric("e2_queue_depth", "gauge", "Work units waiting in the queue");
+    page += e2::format("e2_queue_depth {}\n", snapshot.queue_depth);
+    metric("e2_work_units_generated_total", "counter", "Work units the producer put in the queue");
+    page += e2::format("e2_work_units_generated_total {}\n", snapshot.generated_units);
+    if (snapshot.nodes_counted) {
+        metric("e2_placed_nodes_per_second", "gauge", "Pieces placed over the last report");
+        page += e2::format("e2_placed_nodes_per_second {}\n", snapshot.placed_per_second);
+        metric("e2_checked_nodes_per_second", "gauge", "Candidate pieces tested over the last report");
+        page += e2::format("e2_checked_nodes_per_second {}\n", snapshot.checked_per_second);
+    }
+    if (snapshot.explored.has_value()) {
+        metric("e2_explored_ratio", "gauge", "Estimated share of the search space explored");
+        page += e2::format("e2_explored_ratio {}\n", snapshot.explored.value());
+    }
+    if (snapshot.eta_seconds.has_value()) {
+        metric("e2_eta_seconds", "gauge", "Estimated time left");
+        page += e2::format("e2_eta_seconds {}\n", snapshot.eta_seconds.value());
+    }
+    return page;
+}
+
+// The page the reporter rendered last, the server thread answers every request with it
+INLINE
+void publish_metrics(t_metrics_server& server, std::string page) {
+    std::lock_guard lock(server.mutex);
+    server.page = std::move(page);
+}
+
+INLINE
+void serve_metrics_request(t_metrics_server& server, t_socket client) {
+    // Never wait long on a client
+#if defined(_WIN32)
+    DWORD timeout = 1000;
+#else
+    timeval timeout = { 1, 0 };
+#endif
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+    // Only the request line matters, the rest of the request is ignored
+    char request[1024];
+    const auto received = recv(client, request, sizeof(request) - 1, 0);
+    if (received <= 0)
+        return;
+    request[received] = 0;
+    const std::string request_line(request, std::strcspn(request, "\r\n"));
+
+    std::string response;
+    if (request_line.starts_with("GET /metrics ") || request_line.starts_with("GET / ")) {
+        std::string page;
+        {
+            std::lock_guard lock(server.mutex);
+            page = server.page;
+        }
+        response = e2::format("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", page.size(), page);
+    }
+    else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        const auto count = send(client, response.data() + sent, static_cast<int>(response.size() - sent), SEND_FLAGS);
+        if (count <= 0)
+            break;
+        sent += static_cast<size_t>(count);
+    }
+}
+
+INLINE
+void metrics_server_thread(t_metrics_server& server) {
+    while (!server.stop) {
+        // Wake up now and then to see if we have to stop
+        if (!wait_for_socket(server.listen_socket, 200))
+            continue;
+        const auto client = accept(server.listen_socket, nullptr, nullptr);
+        if (client == NO_SOCKET)
+            continue;
+        serve_metrics_request(server, client);
+        close_socket(client);
+    }
+}
+
+/// <summary>
+///  Listen on 127.0.0.1:port, nullptr if the port can not be used
+/// </summary>
+INLINE
+t_metrics_server* create_metrics_server(uint16_t port) {
+#if defined(_WIN32)
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return nullptr;
+#endif
+    const auto listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_socket == NO_SOCKET)
+        return nullptr;
+
+    const int reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_socket, 8) != 0) {
+        close_socket(listen_socket);
+        return nullptr;
+    }
+
+    auto server = new t_metrics_server();
+    server->listen_socket = listen_socket;
+    server->thread = std::thread(metrics_server_thread, std::ref(*server));
+    return server;
+}
+
+INLINE
+void free_metrics_server(t_metrics_server* server) {
+    if (server == nullptr)
+        return;
+    server->stop = true;
+    server->thread.join();
+    close_socket(server->listen_socket);
+    delete server;
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
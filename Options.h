@@ -10,7 +10,49 @@ typedef struct
     bool DisplayOnConsole;
     bool Bucas;
     int64_t MaxNodesToPlace;
+    double TimeLimit;
     int64_t MaxThreads;
+    int64_t SplitDepth;
+    bool Memo;
+    int64_t MemoSizeMb;
+    std::string Isa;
+    int64_t Interleave;
+    bool Portfolio;
+    int64_t PortfolioSeed;
+    std::string Restart;
+    int64_t RestartNodes;
+    double RestartFactor;
+    bool RestartLearn;
+    bool AdaptiveOrder;
+    std::string OrderScore;
+    double OrderInterval;
+    std::string OrderFile;
+    bool Prefetch;
+    bool HugePages;
+    std::string PuzzleCache;
+    std::string HeatmapFile;
+    std::string Profile;
+    bool Perf;
+    bool Bench;
+    std::string BenchData;
+    int64_t BenchRepeat;
+    int64_t BenchNodes;
+    std::string BenchOutput;
+    std::string BenchBaseline;
+    double BenchThreshold;
+    bool Verify;
+    bool VerifyQuick;
+    std::string VerifyData;
+    int64_t VerifySeed;
+    std::string GenerateFile;
+    int64_t GenerateWidth;
+    int64_t GenerateHeight;
+    int64_t GenerateBorderColors;
+    int64_t GenerateInnerColors;
+    int64_t GenerateSeed;
+    std::string GenerateSolution;
+    int64_t EtaProbes;
+    int64_t MetricsPort;
 } t_options;
 
 INLINE
@@ -22,7 +64,49 @@ static void configure_options(cxxopts::Options& options)
         ("d, display", "Display all solutions on the console", cxxopts::value<bool>()->default_value("false"))
         ("u, bucas", "Display the e2.bucas URL for a solution", cxxopts::value<bool>()->default_value("false"))
         ("m, max-nodes", "Max nodes to place", cxxopts::value<int64_t>()->default_value("-1"))
-        ("n, number-threads", std::format("Max number of threads to use when searching for solutions ({}).", std::thread::hardware_concurrency() - 1), cxxopts::value<int64_t>()->default_value("1"));
+        ("time-limit", "Stop the search after this many seconds, 0 for no limit", cxxopts::value<double>()->default_value("0"))
+        ("n, number-threads", e2::format("Max number of threads to use when searching for solutions ({}).", available_worker_threads()), cxxopts::value<int64_t>()->default_value("1"))
+        ("split-depth", e2::format("Number of cells filled by each work unit, 1 to {}, 0 picks the smallest depth that keeps every thread busy", MAX_WORK_UNIT_DEPTH), cxxopts::value<int64_t>()->default_value("0"))
+        ("memo", "Count solutions using a transposition table shared between threads (no solution display)", cxxopts::value<bool>()->default_value("false"))
+        ("memo-size", "Memory budget for the transposition table in MB", cxxopts::value<int64_t>()->default_value("256"))
+        ("isa", "Instruction set used by the search kernels (auto, scalar, avx2, avx512)", cxxopts::value<std::string>()->default_value("auto"))
+        ("interleave", e2::format("Number of work units each thread searches at the same time, 1 to {}", MAX_INTERLEAVED_LANES), cxxopts::value<int64_t>()->default_value("1"))
+        ("portfolio", "With --first, every thread searches the whole puzzle with its own random candidate order until one of them finds a solution", cxxopts::value<bool>()->default_value("false"))
+        ("portfolio-seed", "Seed for the candidate orders of --portfolio and --restart, the first portfolio thread keeps the regular order", cxxopts::value<int64_t>()->default_value("1"))
+        ("restart", "With --first, every thread searches the whole puzzle in runs with new random candidate orders (none, luby, geometric)", cxxopts::value<std::string>()->default_value("none"))
+        ("restart-nodes", "Placed nodes of the first run of --restart, the unit of the schedule", cxxopts::value<int64_t>()->default_value("100000"))
+        ("restart-factor", "Growth of the budgets of --restart geometric", cxxopts::value<double>()->default_value("1.5"))
+        ("restart-learn", "Keep the pieces of the deepest boards in front from one run of --restart to the next", cxxopts::value<bool>()->default_value("false"))
+        ("adaptive-order", "Sort the candidates of every slot by what the search learned about them, the workers switch orders between work units", cxxopts::value<bool>()->default_value("false"))
+        ("order-score", "What --adaptive-order sorts the candidates by (depth, yield)", cxxopts::value<std::string>()->default_value("depth"))
+        ("order-interval", "Seconds between two orders of --adaptive-order", cxxopts::value<double>()->default_value("1"))
+        ("order-file", "Start --adaptive-order from the statistics in this file and save them back at the end", cxxopts::value<std::string>()->default_value(""))
+        ("prefetch", "Prefetch the candidates of the next cell as soon as a piece is placed", cxxopts::value<bool>()->default_value("false"))
+        ("huge-pages", "Back the candidate tables, boards and search stacks with 2 MiB pages when the system has them", cxxopts::value<bool>()->default_value("false"))
+        ("puzzle-cache", "Directory for compiled puzzles, a later run with the same puzzle and options maps the file instead of preparing the puzzle again", cxxopts::value<std::string>()->default_value(""))
+        ("heatmap", "Record per cell search statistics and write them to this file (.json or .csv)", cxxopts::value<std::string>()->default_value(""))
+        ("profile", "Search build to run, diagnostic (progress, snapshots, stopping) or throughput (only counts solutions)", cxxopts::value<std::string>()->default_value("diagnostic"))
+        ("eta-probes", "Random probes into each work unit to estimate the time left, 0 to turn the estimate off", cxxopts::value<int64_t>()->default_value("32"))
+        ("metrics-port", "Serve Prometheus metrics on this localhost port while solving, 0 to turn it off", cxxopts::value<int64_t>()->default_value("0"))
+        ("perf", "Collect hardware performance counters around each worker's search (Linux only)", cxxopts::value<bool>()->default_value("false"))
+        ("bench", "Run the benchmark ladder over the puzzles in --bench-data instead of solving --puzzle", cxxopts::value<bool>()->default_value("false"))
+        ("bench-data", "Directory holding the benchmark puzzles", cxxopts::value<std::string>()->default_value("data"))
+        ("bench-repeat", "Number of runs for each benchmark puzzle", cxxopts::value<int64_t>()->default_value("3"))
+        ("bench-nodes", "Node budget for the benchmark puzzles that are too big to count", cxxopts::value<int64_t>()->default_value("50000000"))
+        ("bench-output", "Write the benchmark results to this JSON file", cxxopts::value<std::string>()->default_value(""))
+        ("bench-baseline", "Compare the benchmark results with this earlier JSON result file", cxxopts::value<std::string>()->default_value(""))
+        ("bench-threshold", "Allowed drop in placed nodes per second against the baseline, in percent", cxxopts::value<double>()->default_value("5"))
+        ("verify", "Run every search variant on small puzzles and check they find the same solutions", cxxopts::value<bool>()->default_value("false"))
+        ("verify-quick", "Only the fast part of --verify, for use before a merge", cxxopts::value<bool>()->default_value("false"))
+        ("verify-data", "Directory holding the puzzles for --verify", cxxopts::value<std::string>()->default_value("data"))
+        ("verify-seed", "Seed for the random puzzles of --verify", cxxopts::value<int64_t>()->default_value("1"))
+        ("generate", "Write a random solvable puzzle to this file instead of solving --puzzle", cxxopts::value<std::string>()->default_value(""))
+        ("generate-width", "Width of the generated puzzle", cxxopts::value<int64_t>()->default_value("16"))
+        ("generate-height", "Height of the generated puzzle, 0 for a square one", cxxopts::value<int64_t>()->default_value("0"))
+        ("generate-border-colors", "Number of colors between two border pieces of the generated puzzle", cxxopts::value<int64_t>()->default_value("5"))
+        ("generate-inner-colors", "Number of colors between the other pieces of the generated puzzle", cxxopts::value<int64_t>()->default_value("17"))
+        ("generate-seed", "Seed for the generated puzzle", cxxopts::value<int64_t>()->default_value("1"))
+        ("generate-solution", "Also write the solution the puzzle was cut from to this file", cxxopts::value<std::string>()->default_value(""));
 }
 
 INLINE
@@ -31,15 +115,58 @@ static std::optional<std::shared_ptr<t_options>> load_options(cxxopts::Options&
     configure_options(options);
 
     const auto commandLine = options.parse(argc, argv);
-    if (!commandLine.count("puzzle"))
+    if (!commandLine.count("puzzle") && !commandLine["bench"].as<bool>() && !commandLine["verify"].as<bool>() && !commandLine["verify-quick"].as<bool>() && commandLine["generate"].as<std::string>().empty())
         return std::nullopt;
 
     auto puzzle_options = std::make_shared<t_options>();
-    puzzle_options->PuzzleFile = commandLine["puzzle"].as<std::string>();
+    if (commandLine.count("puzzle"))
+        puzzle_options->PuzzleFile = commandLine["puzzle"].as<std::string>();
     puzzle_options->FirstSolution = commandLine["first"].as<bool>();
     puzzle_options->DisplayOnConsole = commandLine["display"].as<bool>();
     puzzle_options->Bucas = commandLine["bucas"].as<bool>();
     puzzle_options->MaxNodesToPlace = commandLine["max-nodes"].as<int64_t>();   
+    puzzle_options->TimeLimit = commandLine["time-limit"].as<double>();
     puzzle_options->MaxThreads = commandLine["number-threads"].as<int64_t>();
+    puzzle_options->SplitDepth = commandLine["split-depth"].as<int64_t>();
+    puzzle_options->Memo = commandLine["memo"].as<bool>();
+    puzzle_options->MemoSizeMb = commandLine["memo-size"].as<int64_t>();
+    puzzle_options->Isa = commandLine["isa"].as<std::string>();
+    puzzle_options->Interleave = commandLine["interleave"].as<int64_t>();
+    puzzle_options->Portfolio = commandLine["portfolio"].as<bool>();
+    puzzle_options->PortfolioSeed = commandLine["portfolio-seed"].as<int64_t>();
+    puzzle_options->Restart = commandLine["restart"].as<std::string>();
+    puzzle_options->RestartNodes = commandLine["restart-nodes"].as<int64_t>();
+    puzzle_options->RestartFactor = commandLine["restart-factor"].as<double>();
+    puzzle_options->RestartLearn = commandLine["restart-learn"].as<bool>();
+    puzzle_options->AdaptiveOrder = commandLine["adaptive-order"].as<bool>();
+    puzzle_options->OrderScore = commandLine["order-score"].as<std::string>();
+    puzzle_options->OrderInterval = commandLine["order-interval"].as<double>();
+    puzzle_options->OrderFile = commandLine["order-file"].as<std::string>();
+    puzzle_options->Prefetch = commandLine["prefetch"].as<bool>();
+    puzzle_options->HugePages = commandLine["huge-pages"].as<bool>();
+    puzzle_options->PuzzleCache = commandLine["puzzle-cache"].as<std::string>();
+    puzzle_options->HeatmapFile = commandLine["heatmap"].as<std::string>();
+    puzzle_options->Profile = commandLine["profile"].as<std::string>();
+    puzzle_options->EtaProbes = commandLine["eta-probes"].as<int64_t>();
+    puzzle_options->MetricsPort = commandLine["metrics-port"].as<int64_t>();
+    puzzle_options->Perf = commandLine["perf"].as<bool>();
+    puzzle_options->Bench = commandLine["bench"].as<bool>();
+    puzzle_options->BenchData = commandLine["bench-data"].as<std::string>();
+    puzzle_options->BenchRepeat = commandLine["bench-repeat"].as<int64_t>();
+    puzzle_options->BenchNodes = commandLine["bench-nodes"].as<int64_t>();
+    puzzle_options->BenchOutput = commandLine["bench-output"].as<std::string>();
+    puzzle_options->BenchBaseline = commandLine["bench-baseline"].as<std::string>();
+    puzzle_options->BenchThreshold = commandLine["bench-threshold"].as<double>();
+    puzzle_options->VerifyQuick = commandLine["verify-quick"].as<bool>();
+    puzzle_options->Verify = commandLine["verify"].as<bool>() || puzzle_options->VerifyQuick;
+    puzzle_options->VerifyData = commandLine["verify-data"].as<std::string>();
+    puzzle_options->VerifySeed = commandLine["verify-seed"].as<int64_t>();
+    puzzle_options->GenerateFile = commandLine["generate"].as<std::string>();
+    puzzle_options->GenerateWidth = commandLine["generate-width"].as<int64_t>();
+    puzzle_options->GenerateHeight = commandLine["generate-height"].as<int64_t>();
+    puzzle_options->GenerateBorderColors = commandLine["generate-border-colors"].as<int64_t>();
+    puzzle_options->GenerateInnerColors = commandLine["generate-inner-colors"].as<int64_t>();
+    puzzle_options->GenerateSeed = commandLine["generate-seed"].as<int64_t>();
+    puzzle_options->GenerateSolution = commandLine["generate-solution"].as<std::string>();
     return puzzle_options;
 }
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Common.h"
+
+/// <summary>
+///  Hardware counters of one worker thread. They only count the thread that opened them ( and only user space ),
+///  so they have to be started and stopped on the worker itself.
+/// </summary>
+typedef struct {
+    int fds[PERF_EVENT::MAX];
+    t_perf_values values;
+    // errno of the first counter that failed to open, 0 if they all opened
+    int error;
+} t_perf_counters;
+
+INLINE
+const char* perf_event_name(PERF_EVENT::PERF_EVENT event) {
+    switch (event) {
+    case PERF_EVENT::INSTRUCTIONS:
+        return "instructions";
+    case PERF_EVENT::CYCLES:
+        return "cycles";
+    case PERF_EVENT::BRANCH_MISSES:
+        return "branch_misses";
+    case PERF_EVENT::L1D_MISSES:
+        return "l1d_misses";
+    case PERF_EVENT::LLC_MISSES:
+        return "llc_misses";
+    default:
+        return "dtlb_misses";
+    }
+}
+
+INLINE
+t_perf_counters* create_perf_counters() {
+    auto counters = new t_perf_counters();
+    for (auto& fd : counters->fds) {
+        fd = -1;
+    }
+    return counters;
+}
+
+#if defined(__linux__)
+INLINE
+void perf_event_config(PERF_EVENT::PERF_EVENT event, perf_event_attr& attributes) {
+    // Cache events are 'cache | operation << 8 | result << 16', we only look at read misses
+    constexpr auto read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    switch (event) {
+    case PERF_EVENT::INSTRUCTIONS:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_EVENT::CYCLES:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_EVENT::BRANCH_MISSES:
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PERF_EVENT::L1D_MISSES:
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+        break;
+    case PERF_EVENT::LLC_MISSES:
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = PERF_COUNT_HW_CACHE_LL | read_miss;
+        break;
+    default:
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = PERF_COUNT_HW_CACHE_DTLB | read_miss;
+        break;
+    }
+}
+#endif
+
+/// <summary>
+///  Open and start the counters for the calling thread. Counters the kernel refuses ( containers, VMs without a PMU,
+///  perf_event_paranoid ) are left out, the search runs the same either way.
+/// </summary>
+INLINE
+void perf_start(t_perf_counters& counters) {
+    counters.values = {};
+    counters.error = 0;
+#if defined(__linux__)
+    for (uint8_t event = 0; event < PERF_EVENT::MAX; ++event) {
+        perf_event_attr attributes = {};
+        attributes.size = sizeof(attributes);
+        perf_event_config(static_cast<PERF_EVENT::PERF_EVENT>(event), attributes);
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        // There are often fewer hardware counters than events, the kernel then multiplexes and we scale
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (fd < 0 && counters.error == 0)
+            counters.error = errno;
+        counters.fds[event] = fd;
+    }
+    for (const auto fd : counters.fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    counters.error = ENOSYS;
+#endif
+}
+
+/// <summary>
+///  Stop the counters and keep their values, has to run on the same thread as 'perf_start'
+/// </summary>
+INLINE
+void perf_stop(t_perf_counters& counters) {
+#if defined(__linux__)
+    for (uint8_t event = 0; event < PERF_EVENT::MAX; ++event) {
+        auto& fd = counters.fds[event];
+        if (fd < 0)
+            continue;
+
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        // value, time enabled, time running
+        uint64_t data[3] = {};
+        if (read(fd, data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+            counters.values.values[event] = data[2] < data[1]
+                ? static_cast<uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]))
+                : data[0];
+            counters.values.valid |= 1u << event;
+        }
+        close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+/// <summary>
+///  Add the counters of one thread, a counter is only valid in the total if it was valid on every thread
+/// </summary>
+INLINE
+void merge_perf_values(t_perf_values& total, const t_perf_values& values, bool first) {
+    for (uint8_t event = 0; event < PERF_EVENT::MAX; ++event) {
+        total.values[event] += values.values[event];
+    }
+    total.valid = first ? values.valid : total.valid & values.valid;
+}
+
+INLINE
+bool is_perf_event_valid(const t_perf_values& values, PERF_EVENT::PERF_EVENT event) {
+    return (values.valid & (1u << event)) != 0;
+}
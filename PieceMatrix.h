@@ -1,10 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <random>
+
+#include "Arena.h"
 #include "Common.h"
 #include "PuzzleLoader.h"
 
 INLINE
-void add_piece(uint8_t rotation, t_piece_matrix_vector* piece_matrix_vector, const t_piece& piece, COLOR_DIRECTION::COLOR_DIRECTION left, COLOR_DIRECTION::COLOR_DIRECTION top, COLOR_DIRECTION::COLOR_DIRECTION right, COLOR_DIRECTION::COLOR_DIRECTION bottom) {
+void add_piece(uint8_t rotation, const t_piece_matrix_vector* piece_matrix_vector, std::vector<t_piece_vector>& buckets, const t_piece& piece, COLOR_DIRECTION::COLOR_DIRECTION left, COLOR_DIRECTION::COLOR_DIRECTION top, COLOR_DIRECTION::COLOR_DIRECTION right, COLOR_DIRECTION::COLOR_DIRECTION bottom) {
     CELL_TYPE::CELL_TYPE cell_type = CELL_TYPE::INNER;
 
     const color_t
@@ -33,12 +37,8 @@ void add_piece(uint8_t rotation, t_piece_matrix_vector* piece_matrix_vector, con
     // We have the 'vector' pointer index in the large array of pointers
     auto total_index = start_matrix_entry_offset + matrix_index;
 
-    if (piece_matrix_vector->pieces[total_index] == nullptr) {
-        piece_matrix_vector->pieces[total_index] = new t_piece_vector();
-    }
-
-    // Add the piece to the vector
-    piece_matrix_vector->pieces[total_index]->push_back({ 
+    // Add the piece to the vector, the lists are only laid out once all the pieces are in
+    buckets[total_index].push_back({ 
         .right = static_cast<uint32_t>(color_right *piece_matrix_vector->stride),
         .bottom = color_bottom,
         .identifier = {
@@ -48,34 +48,102 @@ void add_piece(uint8_t rotation, t_piece_matrix_vector* piece_matrix_vector, con
     });
 }
 
+/// <summary>
+///  Build the piece matrix in the arena. The slot pointers come first, followed by all the candidate lists packed
+///  one after the other in slot order, so the lists of neighboring colors share cache lines and pages.
+/// </summary>
 INLINE
-t_piece_matrix_vector* distribute_pieces(const std::shared_ptr<t_PuzzleData>& puzzle_data) {
+t_piece_matrix_vector* distribute_pieces(const std::shared_ptr<t_PuzzleData>& puzzle_data, t_arena& arena) {
     // how many vectors do we need per cell type?
     // we need max_color * max_color vectors
-    // Calculate the matrix size as a power of two for better memory alignment
     uint32_t cell_type_matrix_size = static_cast<uint32_t>((puzzle_data->max_color + 1) * (puzzle_data->max_color + 1));
     // We need CELL_TYPE::MAX matrices, one for each cell type
     auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * cell_type_matrix_size;
-    auto total_memory_size = total_entries * sizeof(t_piece_vector*);
-    std::cout << "Allocating piece matrix with " << total_memory_size << " bytes\n";
+    auto total_memory_size = sizeof(t_piece_matrix_vector) + total_entries * sizeof(t_candidate_list*);
 
-    auto piece_vector = static_cast<t_piece_matrix_vector*>(_aligned_malloc(total_memory_size, 4096));
+    auto piece_vector = static_cast<t_piece_matrix_vector*>(arena_alloc(arena, total_memory_size, "piece matrix"));
+    if (piece_vector == nullptr)
+        return nullptr;
     piece_vector->cell_type_offset = cell_type_matrix_size;
     piece_vector->stride = puzzle_data->max_color + 1;
 
-    // Initialize the pointers
+    // Sort the pieces into their slots first
+    std::vector<t_piece_vector> buckets(total_entries);
+    for (uint32_t i = 0; i < puzzle_data->width * puzzle_data->height; ++i) {
+        const t_piece& piece = puzzle_data->pieces[i];
+        add_piece(0, piece_vector, buckets, piece, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM);
+        add_piece(1, piece_vector, buckets, piece, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT);
+        add_piece(2, piece_vector, buckets, piece, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP);
+        add_piece(3, piece_vector, buckets, piece, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT);
+    }
+
+    size_t lists_memory_size = 0;
+    for (const auto& bucket : buckets) {
+        if (!bucket.empty())
+            lists_memory_size += sizeof(t_candidate_list) + bucket.size() * sizeof(t_precalculated_piece);
+    }
+    std::cout << e2::format("Allocating piece matrix with {} bytes and {} bytes of candidates\n", total_memory_size, lists_memory_size);
+
+    auto lists = static_cast<uint8_t*>(arena_alloc(arena, std::max<size_t>(lists_memory_size, 1), "candidate lists"));
+    if (lists == nullptr)
+        return nullptr;
     for (uint32_t i = 0; i < total_entries; ++i) {
-        piece_vector->pieces[i] = nullptr;
+        const auto& bucket = buckets[i];
+        if (bucket.empty()) {
+            piece_vector->pieces[i] = nullptr;
+            continue;
+        }
+        auto list = reinterpret_cast<t_candidate_list*>(lists);
+        list->count = static_cast<uint32_t>(bucket.size());
+        list->reserved = 0;
+        memcpy(list->pieces, bucket.data(), bucket.size() * sizeof(t_precalculated_piece));
+        piece_vector->pieces[i] = list;
+        lists += sizeof(t_candidate_list) + bucket.size() * sizeof(t_precalculated_piece);
     }
 
-    // Add the pieces to the matrix
-    for (uint32_t i = 0; i < puzzle_data->width * puzzle_data->height; ++i) {
-        const t_piece& piece = puzzle_data->pieces[i];
-        add_piece(0, piece_vector, piece, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM);
-        add_piece(1, piece_vector, piece, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT);
-        add_piece(2, piece_vector, piece, COLOR_DIRECTION::RIGHT, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP);
-        add_piece(3, piece_vector, piece, COLOR_DIRECTION::BOTTOM, COLOR_DIRECTION::LEFT, COLOR_DIRECTION::TOP, COLOR_DIRECTION::RIGHT);
+    return piece_vector;
+}
+
+/// <summary>
+///  Copy of a piece matrix with the candidates of every slot in a random order, laid out like distribute_pieces does.
+///  The same slots hold the same pieces so any board, work unit or solution is valid for both, only the order the
+///  search tries them in changes. A seed of zero keeps the original order. The slot of the top left cell always
+///  keeps it, the search starts from its first corner and on a board that is not square only some corners can be
+///  the top left one of a solution.
+/// </summary>
+INLINE
+t_piece_matrix_vector* create_shuffled_piece_matrix(const t_piece_matrix_vector& source, t_arena& arena, uint64_t seed) {
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * source.cell_type_offset;
+    auto piece_vector = static_cast<t_piece_matrix_vector*>(arena_alloc(arena, sizeof(t_piece_matrix_vector) + total_entries * sizeof(t_candidate_list*), "piece matrix"));
+    if (piece_vector == nullptr)
+        return nullptr;
+    piece_vector->cell_type_offset = source.cell_type_offset;
+    piece_vector->stride = source.stride;
+
+    size_t lists_memory_size = 0;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        if (source.pieces[i] != nullptr)
+            lists_memory_size += sizeof(t_candidate_list) + source.pieces[i]->size() * sizeof(t_precalculated_piece);
     }
+    auto lists = static_cast<uint8_t*>(arena_alloc(arena, std::max<size_t>(lists_memory_size, 1), "candidate lists"));
+    if (lists == nullptr)
+        return nullptr;
 
+    std::mt19937_64 random(seed);
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        const auto source_list = source.pieces[i];
+        if (source_list == nullptr) {
+            piece_vector->pieces[i] = nullptr;
+            continue;
+        }
+        auto list = reinterpret_cast<t_candidate_list*>(lists);
+        list->count = source_list->count;
+        list->reserved = 0;
+        memcpy(list->pieces, source_list->pieces, source_list->size() * sizeof(t_precalculated_piece));
+        if (seed != 0 && i != CELL_TYPE::INNER)
+            std::shuffle(list->pieces, list->pieces + list->count, random);
+        piece_vector->pieces[i] = list;
+        lists += sizeof(t_candidate_list) + source_list->size() * sizeof(t_precalculated_piece);
+    }
     return piece_vector;
-}
\ No newline at end of file
+}
@@ -14,12 +14,9 @@ void print_piece_solution(std::ostream* stream, const t_board& board, bool secon
     for (auto y = 0; y < height; ++y) {
         for (auto x = 0; x < width; ++x)
         {
-            auto cellIndex = get_idx(x, y, width);
-            if (second_set) {
-                cellIndex += board.actual_total_cells;
-            }
-            const auto& cell = board.cells[cellIndex];
-            (*stream) << std::format("{} ", cell.identifier);
+            const auto cellIndex = get_idx(x, y, width);
+            const auto identifiers = second_set ? board.best_identifiers : board.identifiers;
+            (*stream) << e2::format("{} ", identifiers[cellIndex]);
         }
         (*stream) << "\n";
     }
@@ -50,13 +47,13 @@ void print_url(std::ostream* stream, const t_board& board, const t_puzzle_data_p
             if (cellIndex >= board.max_depth)
                 break;
 
-            const auto& cell = board.cells[cellIndex + board.actual_total_cells];
-            const auto piece = (*puzzle)->pieces[cell.identifier.index];
+            const auto& identifier = board.best_identifiers[cellIndex];
+            const auto piece = (*puzzle)->pieces[identifier.index];
 
-            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::TOP + cell.identifier.rotation) % 4]];
-            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::RIGHT + cell.identifier.rotation) % 4]];
-            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::BOTTOM + cell.identifier.rotation) % 4]];
-            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::LEFT + cell.identifier.rotation) % 4]];
+            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::TOP + identifier.rotation) % 4]];
+            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::RIGHT + identifier.rotation) % 4]];
+            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::BOTTOM + identifier.rotation) % 4]];
+            (*stream) << hex_chars[piece.colors[(COLOR_DIRECTION::LEFT + identifier.rotation) % 4]];
         }
     }
 
@@ -66,9 +63,7 @@ void print_url(std::ostream* stream, const t_board& board, const t_puzzle_data_p
             auto cellIndex = get_idx(x, y, (*puzzle)->width);
             if (cellIndex >= board.max_depth)
                 break;
-            const auto& cell = board.cells[cellIndex + board.actual_total_cells];
-
-            (*stream) << std::format("{:03}", cell.identifier.index);
+            (*stream) << e2::format("{:03}", board.best_identifiers[cellIndex].index);
         }
     }
 
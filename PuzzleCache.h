@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Arena.h"
+#include "Common.h"
+#include "Options.h"
+
+// Bumped whenever the layout below or one of the records in it changes
+constexpr uint32_t PUZZLE_CACHE_VERSION = 1;
+constexpr char PUZZLE_CACHE_MAGIC[8] = { 'E', '2', 'P', 'U', 'Z', 'Z', 'L', 'E' };
+// Slot without candidates
+constexpr uint32_t PUZZLE_CACHE_NO_LIST = UINT32_MAX;
+
+/// <summary>
+///  Start of a compiled puzzle file. The sections follow it, each at the offset given here: the pieces, one offset
+///  per piece matrix slot into the candidate lists, the candidate lists exactly as distribute_pieces packs them, and
+///  the roots of the work units. Everything is in the byte order of the machine that wrote it, the key covers that.
+/// </summary>
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t max_color;
+    uint32_t cell_type_offset;
+    uint32_t stride;
+    uint32_t slot_count;
+    // Number of cells filled by the work units and by their roots
+    uint32_t split_depth;
+    uint32_t root_count;
+    uint64_t pieces_offset;
+    uint64_t slots_offset;
+    uint64_t lists_offset;
+    uint64_t lists_size;
+    uint64_t roots_offset;
+    uint64_t file_size;
+} t_puzzle_cache_header;
+
+/// <summary>
+///  A compiled puzzle: the loaded puzzle, its candidate tables and the roots of its work units, keyed by the puzzle
+///  file and the options that shape them. On a hit the file is mapped and the search reads the candidate lists
+///  straight from the mapping, so it has to stay open for the whole solve.
+/// </summary>
+typedef struct {
+    std::string file_name;
+    uint64_t key;
+    // Set when a valid cache file is mapped
+    const t_puzzle_cache_header* header;
+    uint8_t* memory;
+    size_t size;
+#if defined(_MSC_VER)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} t_puzzle_cache;
+
+INLINE
+uint64_t puzzle_cache_hash(uint64_t hash, const void* data, size_t size) {
+    const auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t idx = 0; idx < size; ++idx) {
+        hash = (hash ^ bytes[idx]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/// <summary>
+///  FNV-1a over the puzzle file and everything that changes what goes in the cache: the options that pick the split
+///  depth and the number of roots, the record layouts and the byte order.
+/// </summary>
+INLINE
+uint64_t puzzle_cache_key(const std::string& puzzle_file_contents, const t_options& options, uint32_t threads) {
+    const uint64_t values[] = {
+        PUZZLE_CACHE_VERSION,
+        0x0102030405060708ull,
+        sizeof(t_piece),
+        sizeof(t_precalculated_piece),
+        sizeof(t_work_unit),
+        static_cast<uint64_t>(options.SplitDepth),
+        static_cast<uint64_t>(options.Interleave),
+        threads
+    };
+    auto hash = puzzle_cache_hash(0xcbf29ce484222325ull, puzzle_file_contents.data(), puzzle_file_contents.size());
+    return puzzle_cache_hash(hash, values, sizeof(values));
+}
+
+INLINE
+void puzzle_cache_unmap(t_puzzle_cache& cache) {
+    if (cache.memory != nullptr) {
+#if defined(_MSC_VER)
+        UnmapViewOfFile(cache.memory);
+#else
+        munmap(cache.memory, cache.size);
+#endif
+    }
+#if defined(_MSC_VER)
+    if (cache.mapping != nullptr)
+        CloseHandle(cache.mapping);
+    if (cache.file != INVALID_HANDLE_VALUE)
+        CloseHandle(cache.file);
+    cache.mapping = nullptr;
+    cache.file = INVALID_HANDLE_VALUE;
+#endif
+    cache.memory = nullptr;
+    cache.size = 0;
+    cache.header = nullptr;
+}
+
+/// <summary>
+///  Map the whole file, copy on write so the puzzle pieces in it can be handed out as a regular t_PuzzleData
+/// </summary>
+INLINE
+bool puzzle_cache_map(t_puzzle_cache& cache) {
+#if defined(_MSC_VER)
+    cache.file = CreateFileA(cache.file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (cache.file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(cache.file, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(sizeof(t_puzzle_cache_header)))
+        return false;
+    cache.mapping = CreateFileMappingA(cache.file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (cache.mapping == nullptr)
+        return false;
+    cache.memory = static_cast<uint8_t*>(MapViewOfFile(cache.mapping, FILE_MAP_COPY, 0, 0, 0));
+    cache.size = static_cast<size_t>(file_size.QuadPart);
+    return cache.memory != nullptr;
+#else
+    const auto file = open(cache.file_name.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(t_puzzle_cache_header))) {
+        close(file);
+        return false;
+    }
+    auto memory = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    // The mapping keeps its own reference to the file
+    close(file);
+    if (memory == MAP_FAILED)
+        return false;
+    cache.memory = static_cast<uint8_t*>(memory);
+    cache.size = static_cast<size_t>(file_stat.st_size);
+    return true;
+#endif
+}
+
+FORCE_INLINE
+bool puzzle_cache_section_fits(const t_puzzle_cache& cache, uint64_t offset, uint64_t size) {
+    return offset <= cache.size && size <= cache.size - offset;
+}
+
+/// <summary>
+///  Check everything the solver will read before trusting the file, a truncated or foreign file is a miss
+/// </summary>
+INLINE
+bool puzzle_cache_validate(const t_puzzle_cache& cache) {
+    const auto& header = *reinterpret_cast<const t_puzzle_cache_header*>(cache.memory);
+    if (memcmp(header.magic, PUZZLE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PUZZLE_CACHE_VERSION || header.header_size != sizeof(t_puzzle_cache_header))
+        return false;
+    if (header.key != cache.key || header.file_size != cache.size)
+        return false;
+    const uint64_t piece_count = static_cast<uint64_t>(header.width) * header.height;
+    if (piece_count == 0 || piece_count > 256 || header.stride != header.max_color + 1 || header.cell_type_offset != header.stride * header.stride)
+        return false;
+    if (header.slot_count != CELL_TYPE::MAX * header.cell_type_offset || header.split_depth == 0 || header.split_depth > MAX_WORK_UNIT_DEPTH)
+        return false;
+    if (!puzzle_cache_section_fits(cache, header.pieces_offset, piece_count * sizeof(t_piece))
+        || !puzzle_cache_section_fits(cache, header.slots_offset, static_cast<uint64_t>(header.slot_count) * sizeof(uint32_t))
+        || !puzzle_cache_section_fits(cache, header.lists_offset, header.lists_size)
+        || !puzzle_cache_section_fits(cache, header.roots_offset, static_cast<uint64_t>(header.root_count) * sizeof(t_work_unit)))
+        return false;
+    if (header.lists_offset % alignof(t_candidate_list) != 0 || header.pieces_offset % alignof(t_piece) != 0)
+        return false;
+
+    const auto slots = reinterpret_cast<const uint32_t*>(cache.memory + header.slots_offset);
+    for (uint32_t idx = 0; idx < header.slot_count; ++idx) {
+        if (slots[idx] == PUZZLE_CACHE_NO_LIST)
+            continue;
+        if (slots[idx] % alignof(t_candidate_list) != 0 || !puzzle_cache_section_fits(cache, header.lists_offset + slots[idx], sizeof(t_candidate_list)))
+            return false;
+        const auto list = reinterpret_cast<const t_candidate_list*>(cache.memory + header.lists_offset + slots[idx]);
+        if (slots[idx] + sizeof(t_candidate_list) + static_cast<uint64_t>(list->count) * sizeof(t_precalculated_piece) > header.lists_size)
+            return false;
+    }
+    return true;
+}
+
+/// <summary>
+///  Look for the compiled version of a puzzle file in 'directory'. The file name holds the key so puzzles and
+///  option sets do not overwrite each other's cache.
+/// </summary>
+/// <returns>nullptr if the puzzle file can not be read, otherwise a cache that is either mapped or ready to be written</returns>
+INLINE
+t_puzzle_cache* open_puzzle_cache(const std::string& directory, const std::string& puzzle_file, const t_options& options, uint32_t threads) {
+    std::ifstream input(puzzle_file, std::ios::binary);
+    if (!input.is_open())
+        return nullptr;
+    const std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    auto cache = new t_puzzle_cache();
+#if defined(_MSC_VER)
+    cache->file = INVALID_HANDLE_VALUE;
+#endif
+    cache->key = puzzle_cache_key(contents, options, threads);
+    cache->file_name = (std::filesystem::path(directory) / e2::format("{}-{:016x}.e2c", std::filesystem::path(puzzle_file).stem().string(), cache->key)).string();
+    if (puzzle_cache_map(*cache) && puzzle_cache_validate(*cache))
+        cache->header = reinterpret_cast<const t_puzzle_cache_header*>(cache->memory);
+    else
+        puzzle_cache_unmap(*cache);
+    return cache;
+}
+
+INLINE
+void free_puzzle_cache(t_puzzle_cache* cache) {
+    if (cache == nullptr)
+        return;
+    puzzle_cache_unmap(*cache);
+    delete cache;
+}
+
+// The puzzle as Puzzle_Load would have returned it, its pieces stay in the mapping
+INLINE
+std::shared_ptr<t_PuzzleData> puzzle_cache_puzzle(const t_puzzle_cache& cache) {
+    auto puzzle = std::make_shared<t_PuzzleData>();
+    puzzle->width = cache.header->width;
+    puzzle->height = cache.header->height;
+    puzzle->max_color = cache.header->max_color;
+    puzzle->pieces = reinterpret_cast<t_piece*>(cache.memory + cache.header->pieces_offset);
+    return puzzle;
+}
+
+/// <summary>
+///  Only the slot pointers are rebuilt in the arena, they point at the candidate lists in the mapping
+/// </summary>
+INLINE
+t_piece_matrix_vector* puzzle_cache_matrix(const t_puzzle_cache& cache, t_arena& arena) {
+    const auto& header = *cache.header;
+    auto piece_vector = static_cast<t_piece_matrix_vector*>(arena_alloc(arena, sizeof(t_piece_matrix_vector) + header.slot_count * sizeof(t_candidate_list*), "piece matrix"));
+    if (piece_vector == nullptr)
+        return nullptr;
+    piece_vector->cell_type_offset = header.cell_type_offset;
+    piece_vector->stride = header.stride;
+    const auto slots = reinterpret_cast<const uint32_t*>(cache.memory + header.slots_offset);
+    for (uint32_t idx = 0; idx < header.slot_count; ++idx) {
+        piece_vector->pieces[idx] = slots[idx] == PUZZLE_CACHE_NO_LIST ? nullptr : reinterpret_cast<const t_candidate_list*>(cache.memory + header.lists_offset + slots[idx]);
+    }
+    return piece_vector;
+}
+
+INLINE
+std::vector<t_work_unit> puzzle_cache_roots(const t_puzzle_cache& cache) {
+    const auto roots = reinterpret_cast<const t_work_unit*>(cache.memory + cache.header->roots_offset);
+    return std::vector<t_work_unit>(roots, roots + cache.header->root_count);
+}
+
+FORCE_INLINE
+uint64_t puzzle_cache_align(uint64_t offset) {
+    return (offset + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+/// <summary>
+///  Write the compiled puzzle for the next run. The candidate lists are one block in the arena ( see
+///  distribute_pieces ), so they are written as they are and the slots become offsets into that block. The file is
+///  written under a temporary name and renamed, workers sharing the directory never map half a file.
+/// </summary>
+INLINE
+bool write_puzzle_cache(const t_puzzle_cache& cache, const t_PuzzleData& puzzle, const t_piece_matrix_vector& piece_vector, uint32_t split_depth, const std::vector<t_work_unit>& roots) {
+    t_puzzle_cache_header header = {};
+    memcpy(header.magic, PUZZLE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PUZZLE_CACHE_VERSION;
+    header.header_size = sizeof(t_puzzle_cache_header);
+    header.key = cache.key;
+    header.width = puzzle.width;
+    header.height = puzzle.height;
+    header.max_color = puzzle.max_color;
+    header.cell_type_offset = piece_vector.cell_type_offset;
+    header.stride = piece_vector.stride;
+    header.slot_count = CELL_TYPE::MAX * piece_vector.cell_type_offset;
+    header.split_depth = split_depth;
+    header.root_count = static_cast<uint32_t>(roots.size());
+
+    // The lists start with the first slot that has one and end after the last one
+    const uint8_t* lists = nullptr;
+    const uint8_t* lists_end = nullptr;
+    for (uint32_t idx = 0; idx < header.slot_count; ++idx) {
+        const auto list = piece_vector.pieces[idx];
+        if (list == nullptr)
+            continue;
+        const auto start = reinterpret_cast<const uint8_t*>(list);
+        const auto end = start + sizeof(t_candidate_list) + list->count * sizeof(t_precalculated_piece);
+        lists = lists == nullptr ? start : std::min(lists, start);
+        lists_end = std::max(lists_end, end);
+    }
+    std::vector<uint32_t> slots(header.slot_count, PUZZLE_CACHE_NO_LIST);
+    for (uint32_t idx = 0; idx < header.slot_count; ++idx) {
+        if (piece_vector.pieces[idx] != nullptr)
+            slots[idx] = static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(piece_vector.pieces[idx]) - lists);
+    }
+
+    const uint64_t piece_count = static_cast<uint64_t>(puzzle.width) * puzzle.height;
+    header.pieces_offset = puzzle_cache_align(sizeof(t_puzzle_cache_header));
+    header.slots_offset = puzzle_cache_align(header.pieces_offset + piece_count * sizeof(t_piece));
+    header.lists_offset = puzzle_cache_align(header.slots_offset + slots.size() * sizeof(uint32_t));
+    header.lists_size = static_cast<uint64_t>(lists_end - lists);
+    header.roots_offset = puzzle_cache_align(header.lists_offset + header.lists_size);
+    header.file_size = header.roots_offset + roots.size() * sizeof(t_work_unit);
+
+    std::vector<uint8_t> contents(header.file_size, 0);
+    memcpy(contents.data(), &header, sizeof(header));
+    memcpy(contents.data() + header.pieces_offset, puzzle.pieces, piece_count * sizeof(t_piece));
+    memcpy(contents.data() + header.slots_offset, slots.data(), slots.size() * sizeof(uint32_t));
+    if (header.lists_size > 0)
+        memcpy(contents.data() + header.lists_offset, lists, header.lists_size);
+    if (!roots.empty())
+        memcpy(contents.data() + header.roots_offset, roots.data(), roots.size() * sizeof(t_work_unit));
+
+    std::error_code error;
+    const auto directory = std::filesystem::path(cache.file_name).parent_path();
+    if (!directory.empty())
+        std::filesystem::create_directories(directory, error);
+    const auto temporary_name = e2::format("{}.{:08x}.tmp", cache.file_name, std::random_device()());
+    {
+        std::ofstream output(temporary_name, std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+            return false;
+        output.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+        if (!output.good())
+            return false;
+    }
+    std::filesystem::rename(temporary_name, cache.file_name, error);
+    if (error) {
+        std::filesystem::remove(temporary_name, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Common.h"
+#include "Options.h"
+#include "PuzzleLoader.h"
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    // Colors used between two border pieces
+    uint32_t border_colors;
+    // Colors used everywhere else inside the board
+    uint32_t inner_colors;
+    uint64_t seed;
+} t_generator_settings;
+
+typedef struct {
+    std::shared_ptr<t_PuzzleData> puzzle;
+    // The board we cut the pieces from, one identifier per cell with the rotation the solver will use for it
+    std::vector<t_piece_identifier> solution;
+} t_generated_puzzle;
+
+/// <summary>
+///  Build a random solved board and cut it into pieces.
+///  - The outer edges use EDGE_COLOR, the edges between two border pieces use one of the border colors and all the
+///    other edges one of the inner colors, the same split as the real puzzle.
+///  - The pieces are shuffled and each one gets a random rotation.
+///  - The solver always starts with the first corner of the file in the top left cell, so that corner is the one
+///    from the top left of our board.
+/// </summary>
+INLINE
+t_generated_puzzle generate_puzzle(const t_generator_settings& settings) {
+    const auto width = settings.width;
+    const auto height = settings.height;
+    const auto total_cells = width * height;
+    std::mt19937_64 random(settings.seed);
+    std::uniform_int_distribution<uint32_t> border_color(1, std::max<uint32_t>(1, settings.border_colors));
+    std::uniform_int_distribution<uint32_t> inner_color(
+        std::max<uint32_t>(1, settings.border_colors) + 1,
+        std::max<uint32_t>(1, settings.border_colors) + std::max<uint32_t>(1, settings.inner_colors));
+
+    // Colors of the edge right of each cell and bellow each cell
+    std::vector<uint32_t> right_edges(total_cells, EDGE_COLOR);
+    std::vector<uint32_t> bottom_edges(total_cells, EDGE_COLOR);
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            const auto idx = get_idx(x, y, width);
+            if (x + 1 < width)
+                right_edges[idx] = (y == 0 || y == height - 1) ? border_color(random) : inner_color(random);
+            if (y + 1 < height)
+                bottom_edges[idx] = (x == 0 || x == width - 1) ? border_color(random) : inner_color(random);
+        }
+    }
+
+    // Random order for the pieces, with the top left corner moved in front of all the other corners
+    std::vector<uint32_t> order(total_cells);
+    for (uint32_t idx = 0; idx < total_cells; ++idx) {
+        order[idx] = idx;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    const uint32_t corners[] = { 0, width - 1, get_idx(0, height - 1, width), total_cells - 1 };
+    auto first_corner = std::find_if(order.begin(), order.end(), [&corners](uint32_t cell) {
+        return std::find(std::begin(corners), std::end(corners), cell) != std::end(corners);
+    });
+    std::iter_swap(first_corner, std::find(order.begin(), order.end(), 0u));
+
+    t_generated_puzzle result;
+    result.puzzle = std::make_shared<t_PuzzleData>();
+    result.puzzle->width = width;
+    result.puzzle->height = height;
+    result.puzzle->pieces = new t_piece[total_cells];
+    result.solution.resize(total_cells);
+
+    uint32_t max_color = 0;
+    std::uniform_int_distribution<uint32_t> rotation_distribution(0, 3);
+    for (uint32_t piece_idx = 0; piece_idx < total_cells; ++piece_idx) {
+        const auto cell = order[piece_idx];
+        const auto x = cell % width;
+        const auto y = cell / width;
+        const uint32_t colors[4] = {
+            x == 0 ? EDGE_COLOR : right_edges[cell - 1],
+            y == 0 ? EDGE_COLOR : bottom_edges[cell - width],
+            right_edges[cell],
+            bottom_edges[cell]
+        };
+
+        // The solver reads rotation R as 'left = colors[R], top = colors[R + 1] ...', store the colors so that the
+        // rotation we picked gives back the colors of the cell
+        const auto rotation = rotation_distribution(random);
+        uint32_t stored[4];
+        for (uint32_t direction = 0; direction < 4; ++direction) {
+            stored[(direction + rotation) % 4] = colors[direction];
+            max_color = std::max(max_color, colors[direction]);
+        }
+        Puzzle_SetPiece(result.puzzle->pieces[piece_idx], piece_idx, stored[0], stored[1], stored[2], stored[3]);
+        result.solution[cell] = {
+            .index = static_cast<uint8_t>(piece_idx),
+            .rotation = static_cast<uint8_t>(rotation)
+        };
+    }
+    result.puzzle->max_color = max_color;
+    return result;
+}
+
+// Write the planted solution, the size and then one line per cell ( row by row ) with the line of the piece in the
+// puzzle file ( starting at 0 ) and its rotation
+INLINE
+bool write_generated_solution(const std::string& solution_file, const t_generated_puzzle& generated)
+{
+    std::ofstream outputFile(solution_file);
+    if (!outputFile.is_open())
+        return false;
+
+    outputFile << generated.puzzle->width << " " << generated.puzzle->height << "\n";
+    for (const auto& identifier : generated.solution) {
+        outputFile << static_cast<uint32_t>(identifier.index) << " " << static_cast<uint32_t>(identifier.rotation) << "\n";
+    }
+    return outputFile.good();
+}
+
+/// <summary>
+///  Generate a puzzle from the --generate options and write it, and the solution if asked for, to disk
+/// </summary>
+INLINE
+int run_generate(const std::shared_ptr<t_options>& options) {
+    const auto width = options->GenerateWidth;
+    const auto height = options->GenerateHeight == 0 ? width : options->GenerateHeight;
+    // Pieces are indexed and colors stored on 8 bits
+    if (width < 2 || height < 2 || width * height > 256) {
+        std::cerr << "The generated puzzle needs at least 2x2 cells and at most 256 pieces\n";
+        return RETURN_ERR;
+    }
+    if (options->GenerateBorderColors < 1 || options->GenerateInnerColors < 1 || options->GenerateBorderColors + options->GenerateInnerColors > 255) {
+        std::cerr << "The generated puzzle needs at least one border and one inner color and at most 255 colors\n";
+        return RETURN_ERR;
+    }
+
+    const t_generator_settings settings = {
+        .width = static_cast<uint32_t>(width),
+        .height = static_cast<uint32_t>(height),
+        .border_colors = static_cast<uint32_t>(options->GenerateBorderColors),
+        .inner_colors = static_cast<uint32_t>(options->GenerateInnerColors),
+        .seed = static_cast<uint64_t>(options->GenerateSeed)
+    };
+    const auto generated = generate_puzzle(settings);
+
+    if (!Puzzle_Save(options->GenerateFile, *generated.puzzle)) {
+        std::cerr << e2::format("Failed to write the puzzle to {}\n", options->GenerateFile);
+        return RETURN_ERR;
+    }
+    std::cout << e2::format("Generated a {}x{} puzzle with {} border and {} inner colors ( seed {} ) in {}\n",
+        settings.width, settings.height, settings.border_colors, settings.inner_colors, settings.seed, options->GenerateFile);
+
+    if (!options->GenerateSolution.empty()) {
+        if (!write_generated_solution(options->GenerateSolution, generated)) {
+            std::cerr << e2::format("Failed to write the solution to {}\n", options->GenerateSolution);
+            return RETURN_ERR;
+        }
+        std::cout << e2::format("Solution written to {}\n", options->GenerateSolution);
+    }
+    return RETURN_OK;
+}
@@ -25,6 +25,27 @@ static bool is_edge(const uint32_t first, const uint32_t second, const uint32_t
     return (first == EDGE_COLOR || second == EDGE_COLOR || third == EDGE_COLOR || fourth == EDGE_COLOR);
 }
 
+// Fill in a piece from its colors in file order ( left, top, right, bottom ) and work out its type
+INLINE
+void Puzzle_SetPiece(t_piece& piece, uint32_t idx, uint32_t first, uint32_t second, uint32_t third, uint32_t fourth)
+{
+    piece.idx = static_cast<uint8_t>(idx);
+    piece.colors[COLOR_DIRECTION::LEFT] = static_cast<color_t>(first);
+    piece.colors[COLOR_DIRECTION::TOP] = static_cast<color_t>(second);
+    piece.colors[COLOR_DIRECTION::RIGHT] = static_cast<color_t>(third);
+    piece.colors[COLOR_DIRECTION::BOTTOM] = static_cast<color_t>(fourth);
+
+    if (is_corner(first, second, third, fourth)) {
+        piece.flags = PIECE_TYPE::CORNER;
+    }
+    else if (is_edge(first, second, third, fourth)) {
+        piece.flags = PIECE_TYPE::EDGE;
+    }
+    else {
+        piece.flags = PIECE_TYPE::INNER;
+    }
+}
+
 INLINE
 t_puzzle_data_ptr Puzzle_Load(const std::string& puzzle_file)
 {
@@ -68,21 +89,7 @@ t_puzzle_data_ptr Puzzle_Load(const std::string& puzzle_file)
         max_color = std::max(max_color, third);
         max_color = std::max(max_color, fourth);
 
-        result->pieces[pieceIdx].idx = static_cast<uint8_t>(pieceIdx);
-        result->pieces[pieceIdx].colors[COLOR_DIRECTION::LEFT] = static_cast<color_t>(first);
-        result->pieces[pieceIdx].colors[COLOR_DIRECTION::TOP] = static_cast<color_t>(second);
-        result->pieces[pieceIdx].colors[COLOR_DIRECTION::RIGHT] = static_cast<color_t>(third);
-        result->pieces[pieceIdx].colors[COLOR_DIRECTION::BOTTOM] = static_cast<color_t>(fourth);
-
-        if (is_corner(first, second, third, fourth)) {
-            result->pieces[pieceIdx].flags = PIECE_TYPE::CORNER;
-        }
-        else if (is_edge(first, second, third, fourth)) {
-            result->pieces[pieceIdx].flags = PIECE_TYPE::EDGE;
-        }
-        else {
-            result->pieces[pieceIdx].flags = PIECE_TYPE::INNER;
-        }
+        Puzzle_SetPiece(result->pieces[pieceIdx], pieceIdx, first, second, third, fourth);
 
         pieceIdx++;
     }
@@ -91,4 +98,21 @@ t_puzzle_data_ptr Puzzle_Load(const std::string& puzzle_file)
     return result;
 }
 
-
+// Write a puzzle in the format Puzzle_Load reads, the size and then one piece per line
+INLINE
+bool Puzzle_Save(const std::string& puzzle_file, const t_PuzzleData& puzzle)
+{
+    std::ofstream outputFile(puzzle_file);
+    if (!outputFile.is_open())
+        return false;
+
+    outputFile << puzzle.width << " " << puzzle.height << "\n";
+    for (uint32_t pieceIdx = 0; pieceIdx < puzzle.width * puzzle.height; ++pieceIdx) {
+        const auto& piece = puzzle.pieces[pieceIdx];
+        outputFile << static_cast<uint32_t>(piece.colors[COLOR_DIRECTION::LEFT]) << " "
+            << static_cast<uint32_t>(piece.colors[COLOR_DIRECTION::TOP]) << " "
+            << static_cast<uint32_t>(piece.colors[COLOR_DIRECTION::RIGHT]) << " "
+            << static_cast<uint32_t>(piece.colors[COLOR_DIRECTION::BOTTOM]) << "\n";
+    }
+    return outputFile.good();
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+
+namespace RESTART_SCHEDULE {
+    enum RESTART_SCHEDULE : uint8_t {
+        // One search to the end, the regular behavior
+        NONE = 0,
+        // Budgets of 1, 1, 2, 1, 1, 2, 4, ... units
+        LUBY,
+        // Budgets growing by a constant factor
+        GEOMETRIC,
+        MAX = GEOMETRIC + 1
+    };
+}
+
+// Every run the learned scores lose that much, so an order that stopped paying off fades out again
+constexpr double RESTART_SCORE_DECAY = 0.5;
+
+INLINE
+const char* restart_schedule_name(RESTART_SCHEDULE::RESTART_SCHEDULE schedule) {
+    switch (schedule) {
+    case RESTART_SCHEDULE::LUBY:
+        return "luby";
+    case RESTART_SCHEDULE::GEOMETRIC:
+        return "geometric";
+    default:
+        return "none";
+    }
+}
+
+INLINE
+std::optional<RESTART_SCHEDULE::RESTART_SCHEDULE> parse_restart_schedule(const std::string& name) {
+    for (uint8_t schedule = 0; schedule < RESTART_SCHEDULE::MAX; ++schedule) {
+        if (name == restart_schedule_name(static_cast<RESTART_SCHEDULE::RESTART_SCHEDULE>(schedule)))
+            return static_cast<RESTART_SCHEDULE::RESTART_SCHEDULE>(schedule);
+    }
+    return std::nullopt;
+}
+
+/// <summary>
+///  Term 'run' ( from 0 ) of the Luby sequence 1, 1, 2, 1, 1, 2, 4, 1, 1, 2, ... Within a constant factor of the
+///  best fixed budget without knowing anything about the search.
+/// </summary>
+INLINE
+uint64_t luby(uint64_t run) {
+    uint64_t index = run + 1;
+    for (;;) {
+        // The smallest 2^k - 1 that reaches the index
+        uint64_t size = 1;
+        while (size < index)
+            size = size * 2 + 1;
+        if (size == index)
+            return (size + 1) / 2;
+        // Otherwise we are in the repeat of the first half
+        index -= size / 2;
+    }
+}
+
+/// <summary>
+///  A worker restarting its search: each run tries the candidates in a new random order until it placed its budget
+///  of nodes. Deterministic orders can spend hours in one barren subtree close to the root, the restarts spread the
+///  time over many of them. The runs never search less than the previous budgets so a tree without a solution is
+///  still covered in the end, by the first run with a large enough budget.
+/// </summary>
+typedef struct {
+    RESTART_SCHEDULE::RESTART_SCHEDULE schedule;
+    // Budget unit, the first run places that many nodes
+    uint64_t base_nodes;
+    // Growth of the geometric budgets
+    double factor;
+    // Keep the pieces of the deepest boards in front from one run to the next
+    bool learn;
+    std::mt19937_64 random;
+    // Per piece index, how much the piece was part of the recent improvements
+    std::vector<double> scores;
+    // Runs started so far, and the budget of the last one
+    uint64_t runs;
+    uint64_t budget;
+} t_restart_state;
+
+INLINE
+t_restart_state* create_restart_state(RESTART_SCHEDULE::RESTART_SCHEDULE schedule, uint64_t base_nodes, double factor, bool learn, uint64_t seed, uint32_t total_pieces) {
+    return new t_restart_state{
+        .schedule = schedule,
+        .base_nodes = std::max<uint64_t>(1, base_nodes),
+        .factor = factor,
+        .learn = learn,
+        .random = std::mt19937_64(seed),
+        .scores = std::vector<double>(total_pieces, 0.0),
+        .runs = 0,
+        .budget = 0
+    };
+}
+
+INLINE
+void free_restart_state(t_restart_state* restart) {
+    delete restart;
+}
+
+// Placed nodes the run 'run' may use
+INLINE
+uint64_t restart_budget(const t_restart_state& restart, uint64_t run) {
+    double units = 1;
+    if (restart.schedule == RESTART_SCHEDULE::LUBY)
+        units = static_cast<double>(luby(run));
+    else if (restart.schedule == RESTART_SCHEDULE::GEOMETRIC)
+        units = std::pow(restart.factor, static_cast<double>(run));
+    const auto budget = units * static_cast<double>(restart.base_nodes);
+    if (restart.schedule == RESTART_SCHEDULE::NONE || budget >= static_cast<double>(std::numeric_limits<uint64_t>::max() / 2))
+        return std::numeric_limits<uint64_t>::max() / 2;
+    return static_cast<uint64_t>(budget);
+}
+
+/// <summary>
+///  New candidate order for the next run. The matrix has to be a copy of our own ( create_shuffled_piece_matrix ),
+///  its lists are rewritten in place. Without learning it is a plain shuffle, with it the pieces are sorted by
+///  their score plus a random key in [0, 1) so they only move ahead of the others while their score lasts. Every
+///  run starts from the same corner as the regular search, so a run that searched its whole tree proves there is
+///  no solution.
+/// </summary>
+INLINE
+void restart_order(t_restart_state& restart, t_piece_matrix_vector& piece_matrix_vector) {
+    std::uniform_real_distribution<double> noise(0.0, 1.0);
+    std::vector<std::pair<double, t_precalculated_piece>> keyed;
+    const auto total_entries = static_cast<uint32_t>(CELL_TYPE::MAX) * piece_matrix_vector.cell_type_offset;
+    for (uint32_t i = 0; i < total_entries; ++i) {
+        auto list = const_cast<t_candidate_list*>(piece_matrix_vector.pieces[i]);
+        // The slot of the top left cell keeps its order ( see create_shuffled_piece_matrix )
+        if (list == nullptr || i == CELL_TYPE::INNER)
+            continue;
+        if (!restart.learn) {
+            std::shuffle(list->pieces, list->pieces + list->count, restart.random);
+            continue;
+        }
+        keyed.clear();
+        for (const auto& piece : *list) {
+            keyed.emplace_back(restart.scores[piece.identifier.index] + noise(restart.random), piece);
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (uint32_t idx = 0; idx < list->count; ++idx) {
+            list->pieces[idx] = keyed[idx].second;
+        }
+    }
+}
+
+/// <summary>
+///  After a run that went deeper than any before it, the pieces of the new deepest board get a point. Every run
+///  first decays the old points, so runs that find nothing new drift back to random orders.
+/// </summary>
+INLINE
+void learn_restart_order(t_restart_state& restart, const t_board& board, uint32_t previous_depth) {
+    for (auto& score : restart.scores) {
+        score *= RESTART_SCORE_DECAY;
+    }
+    if (board.max_depth <= previous_depth)
+        return;
+    for (uint32_t cell_index = 0; cell_index < std::min(board.max_depth, board.total_cells); ++cell_index) {
+        restart.scores[board.best_identifiers[cell_index].index] += 1.0;
+    }
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <limits>
+#include <thread>
+
+#include "Board.h"
+#include "Common.h"
+
+namespace RUN_CONTROL {
+    enum RUN_CONTROL : uint32_t {
+        // Stop this solve ( first solution, node budget, time limit )
+        STOP = 1,
+        // Hold the workers where they are until resumed
+        PAUSE = 2,
+        // Stop asked by a signal, it holds for every solve left in the process
+        INTERRUPT = 4
+    };
+}
+
+// Boards we can reach from a signal handler, one per worker thread
+constexpr uint32_t MAX_CONTROLLED_BOARDS = 1024;
+// How long a paused worker sleeps before it looks again
+constexpr std::chrono::milliseconds RUN_CONTROL_PAUSE_POLL = std::chrono::milliseconds(1);
+// Placed nodes a board takes from the node limit at a time, the limit is overshot by at most the nodes placed
+// while the searches unwind
+constexpr int64_t NODE_LIMIT_CHUNK = 4096;
+
+/// <summary>
+///  Stopping and pausing the search from the outside. The searches only look at their own 'board.done' ( one load
+///  on every cell ), so asking for a stop or a pause sets the flags here and then 'done' on every registered board.
+///  A board that finds 'done' set comes here to see why: it returns for a stop and sleeps through a pause, with its
+///  whole search stack intact. Everything a signal handler calls is a lock free atomic.
+/// </summary>
+typedef struct {
+    std::atomic<uint32_t> flags;
+    std::atomic<uint32_t> board_count;
+    std::atomic<t_board*> boards[MAX_CONTROLLED_BOARDS];
+    // What asked for the stop, a literal
+    std::atomic<const char*> stop_reason;
+    // When the first stop was asked for, steady clock nanoseconds, zero until then
+    std::atomic<int64_t> stop_time;
+    // Placed nodes left to hand out for --max-nodes, only looked at when there is a limit
+    bool node_limited;
+    std::atomic<int64_t> nodes_left;
+} t_run_control;
+
+INLINE
+t_run_control& get_run_control() {
+    static t_run_control control;
+    return control;
+}
+
+FORCE_INLINE
+bool run_control_stopping() {
+    return (get_run_control().flags.load(std::memory_order_relaxed) & (RUN_CONTROL::STOP | RUN_CONTROL::INTERRUPT)) != 0;
+}
+
+FORCE_INLINE
+bool run_control_paused() {
+    return (get_run_control().flags.load(std::memory_order_relaxed) & RUN_CONTROL::PAUSE) != 0;
+}
+
+// What a board starting a new unit should have in 'done', set when it has to come by here first
+FORCE_INLINE
+bool run_control_pending() {
+    return get_run_control().flags.load() != 0;
+}
+
+INLINE
+void run_control_signal_boards() {
+    auto& control = get_run_control();
+    const auto count = std::min(control.board_count.load(), MAX_CONTROLLED_BOARDS);
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        const auto board = control.boards[idx].load();
+        if (board != nullptr)
+            set_board_done(*board, true);
+    }
+}
+
+/// <summary>
+///  Start of a solve, forget the boards of the previous one. A stop from a signal stays, so does a pause.
+/// </summary>
+INLINE
+void run_control_reset() {
+    auto& control = get_run_control();
+    control.board_count = 0;
+    control.flags.fetch_and(~static_cast<uint32_t>(RUN_CONTROL::STOP));
+    if ((control.flags & RUN_CONTROL::INTERRUPT) == 0) {
+        control.stop_reason = nullptr;
+        control.stop_time = 0;
+    }
+}
+
+/// <summary>
+///  Stop the searches once they placed 'max_nodes' between them, zero for no limit. The boards take the nodes in
+///  chunks ( see claim_node_budget ) so the search only compares its own counter with its own budget.
+/// </summary>
+INLINE
+void run_control_set_node_limit(int64_t max_nodes) {
+    auto& control = get_run_control();
+    control.node_limited = max_nodes > 0;
+    control.nodes_left = std::max<int64_t>(max_nodes, 0);
+}
+
+INLINE
+bool run_control_add_board(t_board* board) {
+    auto& control = get_run_control();
+    const auto idx = control.board_count.load();
+    if (idx >= MAX_CONTROLLED_BOARDS)
+        return false;
+    control.boards[idx] = board;
+    control.board_count = idx + 1;
+    // Under a node limit the first cell already comes by for a chunk
+    board->node_budget = control.node_limited ? board->total_placed_nodes : std::numeric_limits<uint64_t>::max();
+    // A stop or pause that came in before the board was known
+    set_board_done(*board, run_control_pending());
+    return true;
+}
+
+/// <summary>
+///  Stop every search, the boards see it on their next cell
+/// </summary>
+/// <returns>true for the request that started the stop, the later ones only add their flag</returns>
+INLINE
+bool request_stop(const char* reason, RUN_CONTROL::RUN_CONTROL flag = RUN_CONTROL::STOP) {
+    auto& control = get_run_control();
+    const char* no_reason = nullptr;
+    const auto first = control.stop_reason.compare_exchange_strong(no_reason, reason);
+    if (first)
+        control.stop_time = std::chrono::steady_clock::now().time_since_epoch().count();
+    control.flags.fetch_or(flag);
+    run_control_signal_boards();
+    return first;
+}
+
+// Time from the first stop request to 'now', zero without a stop
+INLINE
+std::chrono::nanoseconds run_control_stop_latency(std::chrono::steady_clock::time_point now) {
+    const auto stop_time = get_run_control().stop_time.load();
+    if (stop_time == 0)
+        return std::chrono::nanoseconds(0);
+    return now - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(stop_time));
+}
+
+INLINE
+void request_pause() {
+    get_run_control().flags.fetch_or(RUN_CONTROL::PAUSE);
+    run_control_signal_boards();
+}
+
+// The paused boards notice on their own, at most RUN_CONTROL_PAUSE_POLL later
+INLINE
+void request_resume() {
+    get_run_control().flags.fetch_and(~static_cast<uint32_t>(RUN_CONTROL::PAUSE));
+}
+
+// Sleep while paused, false once there is a stop
+INLINE
+bool run_control_wait_paused() {
+    while (run_control_paused() && !run_control_stopping()) {
+        std::this_thread::sleep_for(RUN_CONTROL_PAUSE_POLL);
+    }
+    return !run_control_stopping();
+}
+
+/// <summary>
+///  Slow path of board_stopped, the board was flagged
+/// </summary>
+/// <returns>true if the search has to stop, false when it can go on ( resumed )</returns>
+INLINE
+bool run_control_check(t_board& board) {
+    for (;;) {
+        if (!run_control_wait_paused())
+            return true;
+        set_board_done(board, false);
+        // A pause may have come in between, it would have set 'done' before we cleared it
+        if (!run_control_pending())
+            return false;
+        set_board_done(board, true);
+    }
+}
+
+/// <summary>
+///  Slow path of board_out_of_nodes, the board placed its budget. Take the next chunk of the node limit, or stop
+///  every search once it is gone.
+/// </summary>
+/// <returns>true if the search has to stop</returns>
+INLINE
+bool claim_node_budget(t_board& board) {
+    auto& control = get_run_control();
+    if (!control.node_limited)
+        return true;
+    const auto left = control.nodes_left.fetch_sub(NODE_LIMIT_CHUNK);
+    if (left <= 0) {
+        request_stop("node limit");
+        return true;
+    }
+    board.node_budget = board.total_placed_nodes + static_cast<uint64_t>(std::min(left, NODE_LIMIT_CHUNK));
+    return false;
+}
+
+/// <summary>
+///  The stop check of the searches, a plain load until someone asks for something
+/// </summary>
+FORCE_INLINE
+bool board_stopped(t_board& board) {
+    if (board_done(board)) {
+        [[unlikely]]
+        return run_control_check(board);
+    }
+    return false;
+}
+
+// Same with the node limit, one more compare of two fields of the board
+FORCE_INLINE
+bool board_out_of_nodes(t_board& board) {
+    if (board.total_placed_nodes >= board.node_budget) {
+        [[unlikely]]
+        return claim_node_budget(board);
+    }
+    return board_stopped(board);
+}
+
+extern "C" inline void run_control_signal_handler(int signal) {
+    switch (signal) {
+#if defined(SIGUSR1)
+    case SIGUSR1:
+        request_pause();
+        break;
+    case SIGUSR2:
+        request_resume();
+        break;
+#endif
+    default:
+        request_stop("interrupted", RUN_CONTROL::INTERRUPT);
+        // A second one ends the process the usual way, in case the workers do not come back
+        std::signal(signal, SIG_DFL);
+        break;
+    }
+}
+
+/// <summary>
+///  SIGINT and SIGTERM stop the search and let it print what it found, SIGUSR1 pauses the workers and SIGUSR2
+///  resumes them ( not on Windows )
+/// </summary>
+INLINE
+void install_run_control_signals() {
+    std::signal(SIGINT, run_control_signal_handler);
+    std::signal(SIGTERM, run_control_signal_handler);
+#if defined(SIGUSR1)
+    std::signal(SIGUSR1, run_control_signal_handler);
+    std::signal(SIGUSR2, run_control_signal_handler);
+#endif
+}
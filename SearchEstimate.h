@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "Common.h"
+#include "Board.h"
+
+// Depths bellow the start of a work unit the worker publishes to show how far the search got
+constexpr uint32_t ESTIMATE_STACK_DEPTHS = 16;
+// Size estimates of the running unit we keep, one per progress report
+constexpr uint32_t ESTIMATE_HISTORY = 60;
+
+/// <summary>
+///  Where a worker is in its unit, written by the search on each placement in the first depths of the unit and read
+///  by the reporting thread. Each level holds the position of the piece on the board among the viable pieces of its
+///  candidate list and how many are viable, '( position << 32 ) | viable'. The levels are not written together, the reporter may see a
+///  mix of two placements which is fine for a progress line.
+/// </summary>
+typedef struct st_search_position {
+    std::atomic<uint64_t> levels[ESTIMATE_STACK_DEPTHS];
+    // Levels set for the current placement
+    std::atomic<uint32_t> depth;
+    // Cell the unit starts at, only used by the worker
+    uint32_t start_index;
+} t_search_position;
+
+/// <summary>
+///  What a worker knows about the size of its work units, written by the worker when a unit starts and ends and
+///  read by the reporting thread
+/// </summary>
+typedef struct {
+    std::mutex mutex;
+    std::mt19937_64 random;
+    // Knuth probes at the start of each unit
+    uint32_t probes;
+    // The unit being searched
+    bool active;
+    uint32_t start_index;
+    uint64_t start_nodes;
+    t_search_position position;
+    // Placed nodes the probes expect in the unit, and the variance of that mean
+    double probe_mean;
+    double probe_variance;
+    // Recent estimates of the size of the unit, how much they move tells how far we can trust them. Only the
+    // reports that saw the search move on add one.
+    double history[ESTIMATE_HISTORY];
+    uint32_t history_count;
+    uint32_t history_next;
+    // Share of the unit done at the last report
+    double last_fraction;
+    // Units searched to the end and their actual sizes in placed nodes
+    uint64_t units_done;
+    double done_size_sum;
+    double done_size_squares;
+} t_unit_estimate;
+
+// What the reporter reads from one worker
+typedef struct {
+    bool active;
+    // Placed nodes in the current unit so far
+    double placed;
+    // Expected placed nodes of the whole unit, with a low and a high bound
+    double size;
+    double size_low;
+    double size_high;
+    // The search moved on since the last report. Until it does the size is only the placed nodes over a share
+    // that stands still, it grows with the time spent and tells nothing.
+    bool resolved;
+    uint64_t units_done;
+    double done_size_sum;
+    double done_size_squares;
+} t_unit_snapshot;
+
+typedef struct {
+    bool valid;
+    // Every running unit is resolved, otherwise the numbers below are not worth showing
+    bool resolved;
+    // Placed nodes still to go, with a low and a high bound
+    double remaining;
+    double remaining_low;
+    double remaining_high;
+    // Share of the whole search we went through
+    double explored;
+} t_search_estimate;
+
+INLINE
+t_unit_estimate* create_unit_estimate(uint32_t probes, uint64_t seed) {
+    auto estimate = new t_unit_estimate();
+    estimate->random.seed(seed);
+    estimate->probes = probes;
+    return estimate;
+}
+
+/// <summary>
+///  Knuth's estimator, walk down the tree picking one of the viable pieces at random in each cell. The product of the
+///  branching factors met on the way is an unbiased estimate of the nodes at that depth, so their sum estimates the
+///  placed nodes of the whole subtree. The board is left as it was, apart from the colors and identifiers of the
+///  cells after 'cell_index' which the search always sets before it reads them.
+/// </summary>
+INLINE
+double knuth_probe(t_board& board, uint32_t cell_index, std::mt19937_64& random) {
+    double estimate = 0;
+    double nodes = 1;
+    uint8_t placed[256];
+    uint32_t placed_count = 0;
+    for (; cell_index < board.total_cells; ++cell_index) {
+        const auto pieces = get_cell_candidates(board, cell_index);
+        if (pieces == nullptr)
+            break;
+
+        uint32_t viable = 0;
+        for (const auto& piece : *pieces) {
+            viable += board.used_pieces[piece.identifier.index] ? 0 : 1;
+        }
+        if (viable == 0)
+            break;
+        nodes *= viable;
+        estimate += nodes;
+
+        // Find the pick among the viable pieces and place it
+        auto pick = std::uniform_int_distribution<uint32_t>(0, viable - 1)(random);
+        for (const auto& piece : *pieces) {
+            if (board.used_pieces[piece.identifier.index] || pick-- != 0)
+                continue;
+            place_piece(board, cell_index, piece);
+            board.used_pieces[piece.identifier.index] = true;
+            placed[placed_count++] = piece.identifier.index;
+            break;
+        }
+    }
+
+    for (uint32_t idx = 0; idx < placed_count; ++idx) {
+        board.used_pieces[placed[idx]] = false;
+    }
+    return estimate;
+}
+
+// The piece at 'index' of 'pieces' goes to the cell, it is not marked as used yet
+INLINE
+void publish_search_position(t_board& board, uint32_t cell_index, const t_candidate_list& pieces, uint32_t index) {
+    uint32_t position = 0;
+    uint32_t viable = 0;
+    for (uint32_t idx = 0; idx < pieces.count; ++idx) {
+        if (board.used_pieces[pieces.pieces[idx].identifier.index])
+            continue;
+        position += idx < index ? 1 : 0;
+        viable++;
+    }
+    auto& published = *board.search_position;
+    const auto level = cell_index - published.start_index;
+    published.levels[level].store((static_cast<uint64_t>(position) << 32) | viable, std::memory_order_relaxed);
+    published.depth.store(level + 1, std::memory_order_relaxed);
+}
+
+/// <summary>
+///  A worker starts a unit, probe it before the search runs
+/// </summary>
+INLINE
+void unit_estimate_start(t_unit_estimate& estimate, t_board& board, uint32_t cell_index) {
+    double sum = 0;
+    double squares = 0;
+    for (uint32_t probe = 0; probe < estimate.probes; ++probe) {
+        const auto size = knuth_probe(board, cell_index, estimate.random);
+        sum += size;
+        squares += size * size;
+    }
+    const auto probes = static_cast<double>(std::max<uint32_t>(1, estimate.probes));
+    const auto mean = sum / probes;
+
+    std::lock_guard lock(estimate.mutex);
+    estimate.active = true;
+    estimate.start_index = cell_index;
+    estimate.start_nodes = board.total_placed_nodes;
+    estimate.probe_mean = mean;
+    estimate.probe_variance = std::max(0.0, squares / probes - mean * mean) / probes;
+    estimate.history_count = 0;
+    estimate.history_next = 0;
+    estimate.last_fraction = 0;
+
+    estimate.position.start_index = cell_index;
+    estimate.position.depth.store(0, std::memory_order_relaxed);
+    board.search_position = &estimate.position;
+    board.position_end = std::min(board.total_cells, cell_index + ESTIMATE_STACK_DEPTHS);
+}
+
+INLINE
+void unit_estimate_done(t_unit_estimate& estimate, t_board& board) {
+    board.position_end = 0;
+    std::lock_guard lock(estimate.mutex);
+    const auto size = static_cast<double>(board.total_placed_nodes - estimate.start_nodes);
+    estimate.active = false;
+    estimate.units_done++;
+    estimate.done_size_sum += size;
+    estimate.done_size_squares += size * size;
+}
+
+/// <summary>
+///  How far the search of the current unit got. At each of the first depths of the unit we look up which of the
+///  viable pieces is on the board, 'k of n' at a depth means k / n of that level is done, and each deeper level
+///  refines the share of its parent. The board has to belong to the calling thread, the other threads go through
+///  the positions the search publishes ( see published_stack_fraction ). Cells from 'end_index' on are not looked
+///  at.
+/// </summary>
+INLINE
+double live_stack_fraction(const t_board& board, uint32_t start_index, uint32_t end_index, double& resolution) {
+    bool used[256] = {};
+    for (uint32_t idx = 0; idx < start_index; ++idx) {
+        used[board.identifiers[idx].index] = true;
+    }
+
+    double fraction = 0;
+    double scale = 1;
+    const auto last_index = std::min(board.total_cells, end_index);
+    for (uint32_t cell_index = start_index; cell_index < last_index; ++cell_index) {
+        const auto pieces = get_cell_candidates(board, cell_index);
+        if (pieces == nullptr)
+            break;
+
+        const auto current = board.identifiers[cell_index];
+        uint32_t viable = 0;
+        uint32_t position = UINT32_MAX;
+        for (const auto& piece : *pieces) {
+            if (used[piece.identifier.index])
+                continue;
+            if (piece.identifier.index == current.index && piece.identifier.rotation == current.rotation)
+                position = viable;
+            viable++;
+        }
+        // The search is not that deep right now
+        if (position == UINT32_MAX)
+            break;
+
+        fraction += scale * position / viable;
+        scale /= viable;
+        used[current.index] = true;
+    }
+    resolution = scale;
+    return fraction;
+}
+
+/// <summary>
+///  Same share as live_stack_fraction from what a worker published
+/// </summary>
+INLINE
+double published_stack_fraction(const t_search_position& published, double& resolution) {
+    double fraction = 0;
+    double scale = 1;
+    const auto depth = std::min(ESTIMATE_STACK_DEPTHS, published.depth.load(std::memory_order_relaxed));
+    for (uint32_t level = 0; level < depth; ++level) {
+        const auto value = published.levels[level].load(std::memory_order_relaxed);
+        const auto position = static_cast<uint32_t>(value >> 32);
+        const auto viable = static_cast<uint32_t>(value);
+        if (viable == 0 || position >= viable)
+            break;
+        fraction += scale * position / viable;
+        scale /= viable;
+    }
+    resolution = scale;
+    return fraction;
+}
+
+/// <summary>
+///  Size up the running unit of a worker.
+///  - Once the published position shows part of the unit done the size is 'placed / fraction', before that only
+///    the probes size it. A fraction that did not move since the last report, or a unit that outgrew the probes
+///    before it showed any, is unresolved.
+///  - The subtrees of a unit are far from even so that estimate drifts as the search goes on, the bounds are two
+///    deviations of the recent estimates either way. The probes only bound a unit the position does not size yet.
+/// </summary>
+INLINE
+t_unit_snapshot unit_estimate_snapshot(t_unit_estimate& estimate, const t_board& board) {
+    std::lock_guard lock(estimate.mutex);
+    t_unit_snapshot snapshot = {
+        .active = estimate.active,
+        .placed = static_cast<double>(board.total_placed_nodes - estimate.start_nodes),
+        .size = 0,
+        .size_low = 0,
+        .size_high = 0,
+        .resolved = false,
+        .units_done = estimate.units_done,
+        .done_size_sum = estimate.done_size_sum,
+        .done_size_squares = estimate.done_size_squares
+    };
+    if (!snapshot.active)
+        return snapshot;
+
+    double resolution = 1;
+    const auto fraction = published_stack_fraction(estimate.position, resolution);
+    // The search is somewhere in the part under the deepest piece we looked at, so about this much is done
+    const auto known = snapshot.placed / (fraction + resolution);
+    const auto deviation = std::sqrt(estimate.probe_variance);
+
+    snapshot.size = fraction > 0 ? snapshot.placed / (fraction + resolution / 2) : std::max(known, estimate.probe_mean);
+    snapshot.size_low = snapshot.size;
+    snapshot.size_high = snapshot.size;
+    // Before the position shows anything done the probes size the unit, as long as the share the position leaves
+    // open did not outgrow them
+    snapshot.resolved = fraction > 0 ? fraction != estimate.last_fraction : known <= estimate.probe_mean;
+    estimate.last_fraction = fraction;
+    if (fraction > 0 && snapshot.resolved) {
+        estimate.history[estimate.history_next] = snapshot.size;
+        estimate.history_next = (estimate.history_next + 1) % ESTIMATE_HISTORY;
+        estimate.history_count = std::min(estimate.history_count + 1, ESTIMATE_HISTORY);
+        double sum = 0;
+        double squares = 0;
+        for (uint32_t idx = 0; idx < estimate.history_count; ++idx) {
+            sum += estimate.history[idx];
+            squares += estimate.history[idx] * estimate.history[idx];
+        }
+        const auto count = static_cast<double>(estimate.history_count);
+        const auto spread = std::sqrt(std::max(0.0, squares / count - (sum / count) * (sum / count)));
+        snapshot.size_low = snapshot.size - 2 * spread;
+        snapshot.size_high = snapshot.size + 2 * spread;
+    }
+    else if (fraction == 0 && snapshot.resolved) {
+        // The unit is at least as large as the share the position leaves open says
+        snapshot.size_low = std::max(known, estimate.probe_mean - 2 * deviation);
+        snapshot.size_high = estimate.probe_mean + 2 * deviation;
+    }
+    snapshot.size_high = std::max(snapshot.size_high, snapshot.size_low);
+    return snapshot;
+}
+
+/// <summary>
+///  Put the workers together with the units still in the queue. A queued unit is expected to be the size of an
+///  average unit so far, the finished ones and the running ones, give or take two deviations of the unit sizes and
+///  of their mean.
+/// </summary>
+INLINE
+t_search_estimate combine_unit_estimates(const std::vector<t_unit_snapshot>& snapshots, double queued_units, uint64_t placed_nodes) {
+    t_search_estimate result = {};
+    result.resolved = true;
+    double size_sum = 0;
+    double size_squares = 0;
+    double sizes = 0;
+    for (const auto& snapshot : snapshots) {
+        size_sum += snapshot.done_size_sum;
+        size_squares += snapshot.done_size_squares;
+        sizes += static_cast<double>(snapshot.units_done);
+        if (!snapshot.active)
+            continue;
+
+        result.resolved = result.resolved && snapshot.resolved;
+        result.remaining += std::max(0.0, snapshot.size - snapshot.placed);
+        result.remaining_low += std::max(0.0, snapshot.size_low - snapshot.placed);
+        result.remaining_high += std::max(0.0, snapshot.size_high - snapshot.placed);
+        size_sum += snapshot.size;
+        size_squares += snapshot.size * snapshot.size;
+        sizes += 1;
+    }
+    if (sizes == 0)
+        return result;
+
+    const auto queued = queued_units;
+    const auto mean_size = size_sum / sizes;
+    const auto size_variance = std::max(0.0, size_squares / sizes - mean_size * mean_size);
+    const auto queued_deviation = std::sqrt(queued * size_variance + queued * queued * size_variance / sizes);
+    result.remaining += queued * mean_size;
+    result.remaining_low += std::max(0.0, queued * mean_size - 2 * queued_deviation);
+    result.remaining_high += queued * mean_size + 2 * queued_deviation;
+
+    result.valid = true;
+    const auto done = static_cast<double>(placed_nodes);
+    result.explored = done + result.remaining > 0 ? done / (done + result.remaining) : 1;
+    return result;
+}
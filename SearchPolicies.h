@@ -0,0 +1,202 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "Common.h"
+#include "Board.h"
+#include "CandidateOrder.h"
+#include "CellStatistics.h"
+#include "RunControl.h"
+#include "SearchEstimate.h"
+
+// The backtrackers are templates over a policy bundle, every bit of bookkeeping that is not needed to find the
+// solutions goes through one of the policies below so a build of the search without it has no trace of it left.
+
+// Statistics policies, node counters and the per cell counters
+typedef struct st_count_statistics {
+    FORCE_INLINE
+    static void checked(t_board& board, uint32_t count) {
+        board.total_checked_nodes += count;
+    }
+
+    FORCE_INLINE
+    static void placed(t_board& board) {
+        board.total_placed_nodes++;
+    }
+
+    FORCE_INLINE
+    static void cell_done(t_board& board, uint32_t cell_index, uint64_t checked, uint64_t placed) {
+        if (board.cell_statistics != nullptr) {
+            [[unlikely]]
+            record_cell_visit(board.cell_statistics[cell_index], checked, placed);
+        }
+    }
+
+    FORCE_INLINE
+    static int enter_candidate(t_board&, uint32_t) {
+        return 0;
+    }
+
+    FORCE_INLINE
+    static void leave_candidate(t_board&, const t_precalculated_piece&, int) {}
+} t_count_statistics;
+
+// Also counts what happened below every placed candidate, for the adaptive order
+typedef struct st_candidate_count_statistics : st_count_statistics {
+    FORCE_INLINE
+    static void cell_done(t_board& board, uint32_t cell_index, uint64_t checked, uint64_t placed) {
+        st_count_statistics::cell_done(board, cell_index, checked, placed);
+        reach_candidate_depth(*board.candidate_statistics, cell_index);
+    }
+
+    FORCE_INLINE
+    static t_candidate_mark enter_candidate(t_board& board, uint32_t cell_index) {
+        return mark_candidate(board, cell_index);
+    }
+
+    FORCE_INLINE
+    static void leave_candidate(t_board& board, const t_precalculated_piece& piece, const t_candidate_mark& mark) {
+        record_candidate(board, piece, mark);
+    }
+} t_candidate_count_statistics;
+
+typedef struct st_no_statistics {
+    FORCE_INLINE
+    static void checked(t_board&, uint32_t) {}
+
+    FORCE_INLINE
+    static void placed(t_board&) {}
+
+    FORCE_INLINE
+    static void cell_done(t_board&, uint32_t, uint64_t, uint64_t) {}
+
+    FORCE_INLINE
+    static int enter_candidate(t_board&, uint32_t) {
+        return 0;
+    }
+
+    FORCE_INLINE
+    static void leave_candidate(t_board&, const t_precalculated_piece&, int) {}
+} t_no_statistics;
+
+// Snapshot policies, keep a copy of the deepest board we reached
+typedef struct st_depth_snapshot {
+    FORCE_INLINE
+    static void enter(t_board& board, uint32_t cell_index) {
+        if (board.max_depth < cell_index) {
+            [[unlikely]]
+            board.max_depth = cell_index;
+            copy_cells(board);
+        }
+    }
+    // The piece at 'index' of the list goes to the cell, the first depths of a work unit tell the progress
+    // estimate how far the search got
+    FORCE_INLINE
+    static void placing(t_board& board, uint32_t cell_index, const t_candidate_list& pieces, uint32_t index) {
+        if (cell_index < board.position_end) {
+            [[unlikely]]
+            publish_search_position(board, cell_index, pieces, index);
+        }
+    }
+} t_depth_snapshot;
+
+typedef struct st_no_snapshot {
+    FORCE_INLINE
+    static void enter(t_board&, uint32_t) {}
+    FORCE_INLINE
+    static void placing(t_board&, uint32_t, const t_candidate_list&, uint32_t) {}
+} t_no_snapshot;
+
+// Stop check policies, can the search be stopped from the outside or by the node limit
+typedef struct st_stop_check {
+    FORCE_INLINE
+    static bool stopped(t_board& board) {
+        return board_out_of_nodes(board);
+    }
+} t_stop_check;
+
+// Also stops once the board used its node budget, for the runs of the restarting search
+typedef struct st_budget_stop_check {
+    FORCE_INLINE
+    static bool stopped(t_board& board) {
+        return board_stopped(board) || board.total_placed_nodes >= board.node_budget;
+    }
+} t_budget_stop_check;
+
+// Only stops from the outside ( signals, time limit ), a single load while nobody asks for it
+typedef struct st_signal_stop_check {
+    FORCE_INLINE
+    static bool stopped(t_board& board) {
+        return board_stopped(board);
+    }
+} t_signal_stop_check;
+
+typedef struct st_no_stop_check {
+    FORCE_INLINE
+    static bool stopped(t_board&) {
+        return false;
+    }
+} t_no_stop_check;
+
+// Solution policies, the solutions are always counted, the callback is optional
+typedef struct st_report_solution {
+    FORCE_INLINE
+    static void found(t_board& board) {
+        board.max_depth = board.total_cells;
+        board.total_solutions++;
+        board.solution_callback(board);
+    }
+} t_report_solution;
+
+typedef struct st_count_solution {
+    FORCE_INLINE
+    static void found(t_board& board) {
+        board.total_solutions++;
+    }
+} t_count_solution;
+
+template<typename TStatistics, typename TSnapshot, typename TStopCheck, typename TSolution>
+struct st_search_policy {
+    typedef TStatistics statistics;
+    typedef TSnapshot snapshot;
+    typedef TStopCheck stop_check;
+    typedef TSolution solution;
+};
+
+// Everything on, this is what the search always did
+typedef st_search_policy<t_count_statistics, t_depth_snapshot, t_stop_check, t_report_solution> t_diagnostic_policy;
+// The diagnostic search cut into runs by a node budget
+typedef st_search_policy<t_count_statistics, t_depth_snapshot, t_budget_stop_check, t_report_solution> t_restart_policy;
+// The diagnostic search learning the candidate order
+typedef st_search_policy<t_candidate_count_statistics, t_depth_snapshot, t_stop_check, t_report_solution> t_adaptive_policy;
+// Only counts the solutions, no progress, no snapshots, it does not count the nodes the node limit needs but still
+// stops on a signal or the time limit
+typedef st_search_policy<t_no_statistics, t_no_snapshot, t_signal_stop_check, t_count_solution> t_throughput_policy;
+
+namespace SEARCH_PROFILE {
+    enum SEARCH_PROFILE : uint8_t {
+        DIAGNOSTIC = 0,
+        THROUGHPUT,
+        MAX = THROUGHPUT + 1
+    };
+}
+
+INLINE
+const char* search_profile_name(SEARCH_PROFILE::SEARCH_PROFILE profile) {
+    switch (profile) {
+    case SEARCH_PROFILE::THROUGHPUT:
+        return "throughput";
+    default:
+        return "diagnostic";
+    }
+}
+
+INLINE
+std::optional<SEARCH_PROFILE::SEARCH_PROFILE> parse_search_profile(const std::string& name) {
+    for (uint8_t profile = 0; profile < SEARCH_PROFILE::MAX; ++profile) {
+        if (name == search_profile_name(static_cast<SEARCH_PROFILE::SEARCH_PROFILE>(profile)))
+            return static_cast<SEARCH_PROFILE::SEARCH_PROFILE>(profile);
+    }
+    return std::nullopt;
+}
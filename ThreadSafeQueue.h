@@ -12,18 +12,43 @@ private:
     std::queue<T> queue_;
     mutable std::mutex mutex_;
     std::condition_variable condition_;
+    std::condition_variable not_full_;
+    // 0 means no limit, otherwise push waits for room
+    size_t capacity_ = 0;
+    // Set once nothing more will be pushed
+    bool closed_ = false;
+    size_t pushed_ = 0;
+
+    void take(T& item) {
+        item = queue_.front();
+        queue_.pop();
+        not_full_.notify_one();
+    }
 
 public:
-    void push(const T& item) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    explicit ThreadSafeQueue(size_t capacity = 0) : capacity_(capacity) {}
+
+    // Returns false if the queue was closed before there was room for the item
+    bool push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return capacity_ == 0 || queue_.size() < capacity_ || closed_; });
+        if (closed_)
+            return false;
         queue_.push(item);
+        pushed_++;
         condition_.notify_one();
+        return true;
     }
 
-    void push(T&& item) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    bool push(T&& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return capacity_ == 0 || queue_.size() < capacity_ || closed_; });
+        if (closed_)
+            return false;
         queue_.push(std::move(item));
+        pushed_++;
         condition_.notify_one();
+        return true;
     }
 
     bool pop(T& item) {
@@ -31,29 +56,62 @@ public:
         if (queue_.empty()) {
             return false;
         }
-        item = queue_.front();
-        queue_.pop();
+        take(item);
         return true;
     }
 
     bool wait_and_pop(T& item) {
         std::unique_lock<std::mutex> lock(mutex_);
-        condition_.wait(lock, [this] { return !queue_.empty(); });
-        item = queue_.front();
-        queue_.pop();
+        condition_.wait(lock, [this] { return !queue_.empty() || closed_; });
+        if (queue_.empty())
+            return false;
+        take(item);
         return true;
     }
 
     bool wait_for_pop(T& item, std::chrono::milliseconds timeout) {
         std::unique_lock<std::mutex> lock(mutex_);
-        if (condition_.wait_for(lock, timeout, [this] { return !queue_.empty(); })) {
-            item = queue_.front();
-            queue_.pop();
+        if (condition_.wait_for(lock, timeout, [this] { return !queue_.empty() || closed_; }) && !queue_.empty()) {
+            take(item);
             return true;
         }
         return false;
     }
 
+    // No more pushes, the items already queued can still be popped
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        condition_.notify_all();
+        not_full_.notify_all();
+    }
+
+    // Drop everything still queued, returns how many items that was
+    size_t clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto count = queue_.size();
+        std::queue<T>().swap(queue_);
+        not_full_.notify_all();
+        return count;
+    }
+
+    bool closed() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_;
+    }
+
+    // Closed and empty, nothing will ever come out again
+    bool drained() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_ && queue_.empty();
+    }
+
+    // Number of items pushed since the queue was created
+    size_t pushed() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pushed_;
+    }
+
     bool empty() const {
         std::lock_guard<std::mutex> lock(mutex_);
         return queue_.empty();
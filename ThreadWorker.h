@@ -12,55 +12,263 @@
 #include "ThreadingCommon.h"
 #include "Backtracker.h"
 #include "Formatters.h"
-
-uint32_t apply_hint_pieces(t_piece_vector& hints, t_board* board) {
-    // First mark all pieces as unused
-    std::fill(std::begin(board->used_pieces), std::end(board->used_pieces), false);
-
-    uint32_t cell_index = 0;
-    for (const auto& piece : hints) {
-        auto& cell = board->cells[cell_index++];
-        cell.identifier = piece.identifier;
-        board->cells[cell.right_cell_offset].left_color = piece.right;
-        board->cells[cell.bottom_cell_offset].top_color = piece.bottom;
-        board->used_pieces[piece.identifier.index] = true;
-    }
-    return cell_index;
-}
+#include "CellStatistics.h"
+#include "Metrics.h"
+#include "RunControl.h"
 
 void safe_print(const std::shared_ptr<t_sync_data>& sync, const std::string& message) {
     std::lock_guard lock(sync->print_mutex);
     std::cout << message;
 }
 
+/// <summary>
+///  After a stop nothing left in the queue will be searched, drop it and close the queue so the producers stop too
+/// </summary>
+INLINE
+void discard_work_units(t_thread_data& thread_data) {
+    if (!run_control_stopping())
+        return;
+    thread_data.workQueue->close();
+    thread_data.workQueue->clear();
+}
+
 void worker_thread(t_thread_data& thread_data) {
-    t_piece_vector hints;
+    t_work_unit unit;
     thread_data.is_running = true;
-    while (thread_data.workQueue->wait_for_pop(hints, std::chrono::milliseconds(10)) && !thread_data.sync->done) {
+    while (!thread_data.sync->done && !run_control_stopping()) {
+        // Only the searches with a stop check can pause in the middle of a unit, the others pause here
+        if (!run_control_wait_paused())
+            break;
+        // The producer may still be working on the next units, we are only done once it finished and they are gone
+        if (!thread_data.workQueue->wait_for_pop(unit, std::chrono::milliseconds(10))) {
+            if (thread_data.workQueue->drained())
+                break;
+            continue;
+        }
 
-        thread_data.board->done = false;
-        uint32_t starting_index = apply_hint_pieces(hints, thread_data.board);
-        backtrack(*(thread_data.board), starting_index);
+        // A stop or pause that came in between units is seen on the first cell
+        set_board_done(*thread_data.board, run_control_pending());
+        // Between two units nothing points into the lists of the old order
+        if (thread_data.ordering != nullptr)
+            adopt_candidate_order(*thread_data.board, *thread_data.ordering);
+        uint32_t starting_index = apply_work_unit(unit, thread_data.board);
+        if (starting_index == WORK_UNIT_INVALID)
+            continue;
+        if (thread_data.memo != nullptr) {
+            memo_reset(*thread_data.memo, *thread_data.board);
+            backtrack_memo(*thread_data.memo, *(thread_data.board), starting_index);
+        }
+        else {
+            if (thread_data.estimate != nullptr)
+                unit_estimate_start(*thread_data.estimate, *thread_data.board, starting_index);
+            thread_data.backtrack_function(*(thread_data.board), starting_index);
+            if (thread_data.estimate != nullptr)
+                unit_estimate_done(*thread_data.estimate, *thread_data.board);
+        }
         // Check if we need to stop
-        if (thread_data.sync->done) {
+        if (thread_data.sync->done || run_control_stopping()) {
             break;
         }
     }
+    discard_work_units(thread_data);
+    thread_data.is_running = false;
+}
+
+// Give a lane a work unit, a unit that does not fit leaves the lane idle
+INLINE
+void lane_start_unit(t_search_lane& lane, t_board& stats_board, const t_work_unit& unit) {
+    const auto start_index = apply_work_unit(unit, lane.board);
+    if (start_index != WORK_UNIT_INVALID)
+        lane_start(lane, stats_board, start_index);
+}
+
+/// <summary>
+///  Worker that keeps several work units in flight and advances them round robin, see t_interleaved_search
+/// </summary>
+void interleaved_worker_thread(t_thread_data& thread_data) {
+    auto& search = *thread_data.interleaved;
+    auto& stats_board = *thread_data.board;
+    t_work_unit unit;
+    thread_data.is_running = true;
+    set_board_done(stats_board, run_control_pending());
+    while (!thread_data.sync->done && !run_control_stopping()) {
+        // Give every idle lane a new work unit
+        uint32_t active_lanes = 0;
+        bool queue_drained = false;
+        for (uint32_t idx = 0; idx < search.lane_count; ++idx) {
+            auto& lane = search.lanes[idx];
+            if (!lane.active) {
+                if (thread_data.workQueue->pop(unit))
+                    lane_start_unit(lane, stats_board, unit);
+                else
+                    queue_drained = true;
+            }
+            active_lanes += lane.active ? 1 : 0;
+        }
+
+        if (active_lanes == 0) {
+            // Same exit condition as the plain worker, wait a little for more work and stop once there is none left
+            if (!thread_data.workQueue->wait_for_pop(unit, std::chrono::milliseconds(10))) {
+                if (thread_data.workQueue->drained())
+                    break;
+                continue;
+            }
+            lane_start_unit(search.lanes[0], stats_board, unit);
+            continue;
+        }
+
+        // Step the lanes, go back for more work as soon as one of them finishes, unless the queue is empty already
+        while (!board_stopped(stats_board)) {
+            active_lanes = 0;
+            for (uint32_t idx = 0; idx < search.lane_count; ++idx) {
+                auto& lane = search.lanes[idx];
+                if (lane.active) {
+                    lane_step(lane, stats_board);
+                    active_lanes += lane.active ? 1 : 0;
+                }
+            }
+            if (active_lanes == 0 || (!queue_drained && active_lanes < search.lane_count))
+                break;
+        }
+    }
+    discard_work_units(thread_data);
     thread_data.is_running = false;
 }
 
+/// <summary>
+///  Portfolio worker: instead of a share of the work units it races the other workers on the whole puzzle, each one
+///  trying the candidates in a different order. With --first the first solution stops them all. The time to the
+///  first solution varies a lot with the order, so the fastest of several orders beats splitting one of them.
+/// </summary>
+void portfolio_worker_thread(t_thread_data& thread_data) {
+    auto& board = *thread_data.board;
+    thread_data.is_running = true;
+    std::vector<t_precalculated_piece> piece_stack;
+    set_board_matrix(board, thread_data.portfolio_matrix);
+    // The top left slot keeps the regular order, every worker starts from the same corner
+    place_first_corner(board, thread_data.portfolio_matrix, piece_stack);
+    set_board_done(board, run_control_pending());
+    if (!run_control_stopping())
+        thread_data.backtrack_function(board, 1);
+    thread_data.is_running = false;
+}
+
+/// <summary>
+///  Restarting worker: like the portfolio worker it searches the whole puzzle on its own matrix, but in runs. Each
+///  run reorders the candidates and stops after the node budget of the schedule. A run that ends under its budget
+///  searched the whole tree, there is nothing left to restart for.
+/// </summary>
+void restart_worker_thread(t_thread_data& thread_data) {
+    auto& board = *thread_data.board;
+    auto& restart = *thread_data.restart;
+    auto& piece_matrix_vector = *thread_data.portfolio_matrix;
+    thread_data.is_running = true;
+    std::vector<t_precalculated_piece> piece_stack;
+    set_board_matrix(board, &piece_matrix_vector);
+    // The reordering leaves the first corner alone, every run starts from it
+    place_first_corner(board, &piece_matrix_vector, piece_stack);
+    while (run_control_wait_paused()) {
+        restart_order(restart, piece_matrix_vector);
+        const auto previous_depth = board.max_depth;
+        restart.budget = restart_budget(restart, restart.runs++);
+        board.node_budget = board.total_placed_nodes + restart.budget;
+        set_board_done(board, run_control_pending());
+        thread_data.backtrack_function(board, 1);
+        // Stopped from the outside ( a solution ) or the whole tree fit in the budget
+        if (board.total_placed_nodes < board.node_budget) {
+            if (!run_control_stopping())
+                request_stop("a run searched the whole tree, there is no solution");
+            break;
+        }
+        if (restart.learn)
+            learn_restart_order(restart, board, previous_depth);
+    }
+    thread_data.is_running = false;
+}
+
+/// <summary>
+///  Thread entry point, the hardware counters have to be opened on the thread they count
+/// </summary>
+void run_worker_thread(t_thread_data& thread_data) {
+    if (thread_data.perf != nullptr)
+        perf_start(*thread_data.perf);
+
+    if (thread_data.restart != nullptr)
+        restart_worker_thread(thread_data);
+    else if (thread_data.portfolio_matrix != nullptr)
+        portfolio_worker_thread(thread_data);
+    else if (thread_data.interleaved != nullptr)
+        interleaved_worker_thread(thread_data);
+    else
+        worker_thread(thread_data);
+
+    if (thread_data.perf != nullptr)
+        perf_stop(*thread_data.perf);
+}
+
+/// <summary>
+///  Publish a new candidate order now and then, for as long as the workers search. The workers never wait for it,
+///  they pick the order up when they start their next work unit.
+/// </summary>
+void candidate_order_thread(t_candidate_ordering& ordering, t_arena& arena, std::shared_ptr<t_sync_data> sync, double interval_seconds) {
+    const auto interval = std::chrono::duration<double>(interval_seconds);
+    auto last_order = std::chrono::steady_clock::now();
+    while (!sync->done && !run_control_stopping()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (std::chrono::steady_clock::now() - last_order < interval)
+            continue;
+        reorder_candidates(ordering, arena);
+        last_order = std::chrono::steady_clock::now();
+    }
+}
+
+/// <summary>
+///  Add up the per cell counters of all the threads and write them to a file
+/// </summary>
+INLINE
+void write_heatmap(const std::vector<t_thread_data>& thread_data, const std::shared_ptr<t_sync_data>& sync, const std::string& file_name) {
+    const auto& board = *thread_data.at(0).board;
+    auto cell_statistics = create_cell_statistics(board.total_cells);
+    for (const auto& data : thread_data) {
+        merge_cell_statistics(cell_statistics, data.board->cell_statistics, board.total_cells);
+    }
+    const auto width = board.cells_stride;
+    const auto height = board.total_cells / board.cells_stride;
+    if (write_cell_statistics(file_name, cell_statistics, width, height))
+        safe_print(sync, e2::format("\nCell statistics written to {}\n", file_name));
+    else
+        safe_print(sync, e2::format("\nFailed to write the cell statistics to {}\n", file_name));
+    free_cell_statistics(cell_statistics);
+}
+
 void reporting_thread(
     const std::shared_ptr<std::vector<t_thread_data>>& thread_data,
     t_statistics_data& total_statistics,
     std::shared_ptr<t_sync_data> sync,
-    const std::shared_ptr<t_options>& options
+    const std::shared_ptr<t_options>& options,
+    t_metrics_server* metrics = nullptr
 ) {
-    const auto inital_number_of_work_items = thread_data->at(0).workQueue->size();
+    const auto& producer = *thread_data->at(0).producer;
+    const auto reporter_start = std::chrono::steady_clock::now();
+    const auto time_limit = std::chrono::duration<double>(options->TimeLimit);
+    // The throughput build does not count the nodes, zeros would read like a measurement
+    const bool nodes_counted = options->Profile != search_profile_name(SEARCH_PROFILE::THROUGHPUT);
+    // Placed nodes per second, smoothed so the ETA does not jump around
+    double placed_rate = 0;
     // We will report every second the total number of solutions and nodes placed
-    // Go through each thread data and sum up the values
-    while (!sync->done) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        const auto remaining_work_items = thread_data->at(0).workQueue->size();
+    // Go through each thread data and sum up the values, at least once so a search that ends before we get here is
+    // still counted
+    do {
+        // Wake up early once the workers are done, short runs should not wait for the full second
+        for (uint32_t slice = 0; slice < 100 && !sync->done; ++slice) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (options->TimeLimit > 0 && std::chrono::steady_clock::now() - reporter_start >= time_limit && !run_control_stopping())
+                request_stop("time limit");
+        }
+        const auto remaining_work_items = producer.queue->size();
+        // The total is only known once the producer is done, until then it is what it generated so far
+        const auto generated_work_items = producer.queue->pushed();
+        const auto generating = !producer.queue->closed();
 
         t_statistics_data last_statistics = {};
         for (const auto& data : *thread_data) {
@@ -80,47 +288,94 @@ void reporting_thread(
         std::string stopped_threads_str(thread_data->size() - running_threads, '.');
 
 
-        const auto str = std::format("\rSolutions: {}. Stats: {} pps | {} cps | {} placed | {} checked. Sets remaining {}/{}. Workers: \033[32m{}\033[31m{}\033[0m",
-            last_statistics.total_solutions.load(),
+        const auto stats_str = nodes_counted ? e2::format("{} pps | {} cps | {} placed | {} checked",
             format_number_human_readable(diff_nodes_placed),
             format_number_human_readable(diff_nodes_checked),
             format_number_human_readable(last_statistics.total_nodes_placed),
-            format_number_human_readable(last_statistics.total_nodes_checked),
+            format_number_human_readable(last_statistics.total_nodes_checked)) : std::string("n/a");
+        const auto str = e2::format("\rSolutions: {}. Stats: {}. Sets remaining {}/{}{}. Workers: \033[32m{}\033[31m{}\033[0m",
+            last_statistics.total_solutions.load(),
+            stats_str,
             remaining_work_items,
-            inital_number_of_work_items,
+            generated_work_items,
+            generating ? "+" : "",
             running_threads_str,
             stopped_threads_str);
 
-        safe_print(sync, str);
+        placed_rate = placed_rate == 0 ? static_cast<double>(diff_nodes_placed) : 0.7 * placed_rate + 0.3 * static_cast<double>(diff_nodes_placed);
+        std::string eta_str;
+        t_search_estimate estimate = {};
+        const auto expected_work_items = expected_work_units(producer);
+        if (thread_data->at(0).estimate != nullptr && placed_rate > 0 && expected_work_items.has_value() && !run_control_stopping()) {
+            std::vector<t_unit_snapshot> snapshots;
+            for (auto& data : *thread_data) {
+                snapshots.push_back(unit_estimate_snapshot(*data.estimate, *data.board));
+            }
+            // The units still in the queue and the ones the producer has yet to generate
+            const auto queued_work_items = static_cast<double>(remaining_work_items) + expected_work_items.value() - static_cast<double>(generated_work_items);
+            estimate = combine_unit_estimates(snapshots, queued_work_items, last_statistics.total_nodes_placed);
+            // A unit the search did not move on in gives a size that only grows with the time spent
+            if (estimate.valid && !estimate.resolved) {
+                eta_str = " ETA unresolved";
+            }
+            else if (estimate.valid) {
+                eta_str = e2::format(" Explored {:.3g}%. ETA {} ({} - {})",
+                    estimate.explored * 100,
+                    format_eta(estimate.remaining / placed_rate),
+                    format_eta(estimate.remaining_low / placed_rate),
+                    format_eta(estimate.remaining_high / placed_rate));
+            }
+        }
+
+        safe_print(sync, str + eta_str + (run_control_paused() ? " Paused" : ""));
+
+        if (metrics != nullptr) {
+            // Same numbers as the progress line
+            t_metrics_snapshot snapshot = {
+                .workers = {},
+                .queue_depth = remaining_work_items,
+                .generated_units = generated_work_items,
+                .total_cells = thread_data->at(0).board->total_cells,
+                .nodes_counted = nodes_counted,
+                .placed_per_second = static_cast<double>(diff_nodes_placed),
+                .checked_per_second = static_cast<double>(diff_nodes_checked),
+                .explored = std::nullopt,
+                .eta_seconds = std::nullopt
+            };
+            for (const auto& data : *thread_data) {
+                snapshot.workers.push_back({
+                    .placed = data.board->total_placed_nodes,
+                    .checked = data.board->total_checked_nodes,
+                    .solutions = data.board->total_solutions,
+                    .max_depth = data.board->max_depth,
+                    .running = data.is_running
+                });
+            }
+            if (estimate.valid && estimate.resolved) {
+                snapshot.explored = estimate.explored;
+                snapshot.eta_seconds = estimate.remaining / placed_rate;
+            }
+            publish_metrics(*metrics, render_metrics(snapshot));
+        }
 
 
         total_statistics.total_solutions.store(last_statistics.total_solutions);
         total_statistics.total_nodes_placed.store(last_statistics.total_nodes_placed);
         total_statistics.total_nodes_checked.store(last_statistics.total_nodes_checked);
 
-        if (options->FirstSolution && total_statistics.total_solutions > 0) {
-            // Clear the work queue
-            thread_data->at(0).workQueue->empty();
-
-            sync->done = true;
-            // Stop all boards
-            for(auto& data : *thread_data) {
-                stop_board(*data.board);
-            }
-            break;
+        // The plain depth first search stops itself at the node limit ( claim_node_budget ), this catches the
+        // searches without a node budget ( memo, interleaved ). The first solution stops the search from the worker
+        // that found it. We keep reporting until the workers are gone so the last counters make it in.
+        if (options->MaxNodesToPlace > 0 && total_statistics.total_nodes_placed >= static_cast<uint64_t>(options->MaxNodesToPlace) && !sync->done && !run_control_stopping()) {
+            request_stop("node limit");
         }
+    } while (!sync->done);
 
-        // If we have a max nodes to place, check if we reached it
-        if (options->MaxNodesToPlace > 0 && total_statistics.total_nodes_placed >= static_cast<uint64_t>(options->MaxNodesToPlace)) {
-            // Clear the work queue
-            thread_data->at(0).workQueue->empty();
-
-            sync->done = true;
-            // Stop all boards
-            for(auto& data : *thread_data) {
-                stop_board(*data.board);
-            }
-            break;
+    if (!options->HeatmapFile.empty()) {
+        // We may have stopped the search ourselves, the workers still have to see that before we read their counters
+        while (std::any_of(thread_data->begin(), thread_data->end(), [](const t_thread_data& data) { return data.is_running; })) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
+        write_heatmap(*thread_data, sync, options->HeatmapFile);
     }
 }
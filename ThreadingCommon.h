@@ -1,23 +1,61 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <vector>
 
 #include "Common.h"
 #include "ThreadSafeQueue.h"
 #include "Board.h"
+#include "Backtracker.h"
+#include "MemoBacktracker.h"
+#include "InterleavedBacktracker.h"
+#include "PerfCounters.h"
+#include "CandidateOrder.h"
+#include "RestartSearch.h"
+#include "RunControl.h"
+#include "SearchEstimate.h"
 
 typedef struct {
     std::atomic<bool> done;
     std::mutex print_mutex;
+    // One more than the index of the worker that found the solution reported with --first, zero until then
+    std::atomic<uint32_t> first_solution_worker;
 } t_sync_data;
 
+struct st_work_producer;
+
 typedef struct {
     std::shared_ptr<t_PuzzleData> puzzleData;
     t_piece_matrix_vector* pieceMatrixVector;
-    std::shared_ptr<ThreadSafeQueue<t_piece_vector>> workQueue;
+    std::shared_ptr<ThreadSafeQueue<t_work_unit>> workQueue;
+    // Fills the work queue, shared by all the threads
+    struct st_work_producer* producer;
     std::shared_ptr<t_sync_data> sync;
     t_board* board;
+    // The backtracking variant this worker runs
+    t_backtrack_function backtrack_function;
+    // Set when we only count solutions using the shared transposition table
+    t_memo_context* memo;
+    // Set when this worker interleaves several work units
+    t_interleaved_search* interleaved;
+    // Set when we collect hardware counters around the search
+    t_perf_counters* perf;
+    // Set when we estimate the size of the work units for the progress line
+    t_unit_estimate* estimate;
+    // Set in portfolio mode, the worker searches the whole puzzle with the candidates in its own order
+    t_piece_matrix_vector* portfolio_matrix;
+    // What shuffled that order, zero is the order of distribute_pieces
+    uint64_t portfolio_seed;
+    // Set when the worker restarts its search on the portfolio matrix with new orders
+    t_restart_state* restart;
+    // Set when the candidate order adapts to the search, shared by all the workers
+    t_candidate_ordering* ordering;
     bool is_running;
 } t_thread_data;
 
@@ -50,15 +88,18 @@ void merge_values(const t_piece_vector& extra_pieces, std::vector<t_piece_vector
 }
 
 void backtrack_generator(t_board& board, uint32_t cell_index, std::vector<t_precalculated_piece>& piece_stack, const std::function<void(const std::vector<t_precalculated_piece>& pieces)>& callback, uint32_t max_depth) {
+    // The callback can stop the generator
+    if (board.done)
+        return;
+
     // If we reached the end of the board, we are done
     if (cell_index == max_depth) {
         callback(piece_stack);
         return;
     }
 
-    auto& cell = board.cells[cell_index];
     // Get the vector responsible for the current cell
-    const auto pieces = cell.pieces[cell.left_color + cell.top_color];
+    const auto pieces = get_cell_candidates(board, cell_index);
     if (pieces == nullptr || board.done)
         return;
 
@@ -70,9 +111,7 @@ void backtrack_generator(t_board& board, uint32_t cell_index, std::vector<t_prec
             continue; // Piece already used
         piece_stack.push_back(piece);
         // Update some basic and really important information
-        cell.identifier = piece.identifier;
-        board.cells[cell.right_cell_offset].left_color = piece.right;
-        board.cells[cell.bottom_cell_offset].top_color = piece.bottom;
+        place_piece(board, cell_index, piece);
         // Mark the piece as used
         board.used_pieces[piece.identifier.index] = true;
         // Classic recursive backtrack
@@ -84,63 +123,275 @@ void backtrack_generator(t_board& board, uint32_t cell_index, std::vector<t_prec
 }
 
 
+// Only the identifiers of the pieces are kept, the worker finds their colors again
+INLINE
+t_work_unit make_work_unit(const t_board& board, uint32_t depth) {
+    t_work_unit unit = {};
+    unit.depth = static_cast<uint8_t>(std::min(depth, MAX_WORK_UNIT_DEPTH));
+    for (uint32_t idx = 0; idx < unit.depth; ++idx) {
+        unit.pieces[idx] = board.identifiers[idx];
+    }
+    return unit;
+}
+
+// Work units waiting in the queue at most, the producers wait for the workers when they are that far ahead
+constexpr size_t WORK_QUEUE_CAPACITY = 1 << 16;
+// Units a producer keeps while it waits for its turn, then it waits with a full buffer
+constexpr size_t WORK_PRODUCER_BUFFER = 4096;
+// Roots for every producer thread, so one large subtree does not leave the others idle
+constexpr uint32_t WORK_PRODUCER_ROOTS = 4;
+
+/// <summary>
+///  Generates the work units while the workers already search the first ones.
+///  The prefix tree is cut in roots a few cells deep and the producer threads expand the roots in parallel. The
+///  units still reach the queue in the order a single thread would generate them: only the producer holding the
+///  oldest unfinished root pushes, the others fill a buffer and wait for their turn. So the ids and the order of
+///  the units do not depend on the number of threads.
+/// </summary>
+typedef struct st_work_producer {
+    std::shared_ptr<ThreadSafeQueue<t_work_unit>> queue;
+    const t_piece_matrix_vector* pieceMatrixVector;
+    // Number of cells filled by every unit
+    uint32_t depth;
+    std::vector<t_work_unit> roots;
+    // One board per producer thread
+    std::vector<t_board*> boards;
+    std::vector<std::thread> threads;
+    // Next root to hand out
+    std::atomic<uint32_t> next_root;
+    // The root whose units go to the queue now
+    std::mutex turn_mutex;
+    std::condition_variable turn;
+    uint32_t pushing_root;
+    // How far the pushed units got in the prefix tree ( see live_stack_fraction ), published by the producer that
+    // pushed them since the reporter can not look at its board. Negative until the first push.
+    std::atomic<double> pushed_fraction;
+    std::atomic<double> pushed_resolution;
+    // Only touched by the producer whose turn it is
+    uint32_t next_id;
+    // Set when the queue was closed under us
+    std::atomic<bool> stopped;
+    // Producer threads still expanding roots
+    std::atomic<uint32_t> running;
+    std::chrono::steady_clock::time_point start_time;
+    // Time from the start to the first unit in the queue, zero until then
+    std::atomic<int64_t> first_unit_nanoseconds;
+} t_work_producer;
+
+// The prefixes all start with the first corner piece
+INLINE
+void place_first_corner(t_board& board, const t_piece_matrix_vector* piece_vector_matrix, std::vector<t_precalculated_piece>& piece_stack) {
+    const auto& corner_piece = piece_vector_matrix->pieces[CELL_TYPE::INNER]->pieces[0];
+    place_piece(board, 0, corner_piece);
+    board.used_pieces[corner_piece.identifier.index] = true;
+    piece_stack.clear();
+    piece_stack.push_back(corner_piece);
+}
+
+/// <summary>
+///  The shallowest depth that gives at least 'target' units. Each depth is only counted up to the target so this
+///  stays cheap however large the deeper levels are.
+/// </summary>
+INLINE
+uint32_t choose_split_depth(t_board& board, const t_piece_matrix_vector* piece_vector_matrix, uint32_t max_depth, uint64_t target) {
+    std::vector<t_precalculated_piece> piece_stack;
+    place_first_corner(board, piece_vector_matrix, piece_stack);
+    for (uint32_t depth = 1; depth < max_depth; ++depth) {
+        uint64_t count = 0;
+        backtrack_generator(board, 1, piece_stack, [&board, &count, target](const auto&) {
+            if (++count >= target)
+                board.done = true;
+        }, depth);
+        board.done = false;
+        // Deeper levels can only have more units, unless there are none at all
+        if (count >= target || count == 0)
+            return depth;
+    }
+    return max_depth;
+}
+
+// Wait until the units of 'root' can go to the queue, false if the producers were stopped
+INLINE
+bool wait_for_turn(t_work_producer& producer, uint32_t root) {
+    std::unique_lock lock(producer.turn_mutex);
+    producer.turn.wait(lock, [&producer, root] { return producer.pushing_root == root || producer.stopped; });
+    return !producer.stopped;
+}
+
+INLINE
+void finish_turn(t_work_producer& producer) {
+    std::lock_guard lock(producer.turn_mutex);
+    producer.pushing_root++;
+    producer.turn.notify_all();
+}
+
+INLINE
+bool push_work_units(t_work_producer& producer, std::vector<t_work_unit>& units, const t_board& board) {
+    for (auto& unit : units) {
+        unit.id = producer.next_id++;
+        // Paused producers hold on to their units, a stop drops them
+        if (!run_control_wait_paused() || !producer.queue->push(unit)) {
+            // Nobody is left to take them
+            std::lock_guard lock(producer.turn_mutex);
+            producer.stopped = true;
+            producer.turn.notify_all();
+            return false;
+        }
+        if (producer.first_unit_nanoseconds == 0) {
+            producer.first_unit_nanoseconds = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - producer.start_time).count());
+        }
+    }
+    // The board is still on the last unit we generated, unless the root is done
+    double resolution = 1;
+    const auto fraction = live_stack_fraction(board, 1, producer.depth, resolution);
+    if (fraction > 0) {
+        producer.pushed_resolution.store(resolution, std::memory_order_relaxed);
+        producer.pushed_fraction.store(fraction, std::memory_order_release);
+    }
+    units.clear();
+    return true;
+}
+
+INLINE
+void work_producer_thread(t_work_producer& producer, uint32_t producer_index) {
+    auto& board = *producer.boards[producer_index];
+    std::vector<t_precalculated_piece> piece_stack;
+    std::vector<t_work_unit> units;
+    while (!producer.stopped) {
+        const auto root = producer.next_root++;
+        if (root >= producer.roots.size())
+            break;
+
+        bool my_turn = false;
+        const auto start_index = apply_work_unit(producer.roots[root], &board);
+        if (start_index != WORK_UNIT_INVALID) {
+            backtrack_generator(board, start_index, piece_stack, [&producer, &board, &units, &my_turn, root](const auto&) {
+                units.push_back(make_work_unit(board, producer.depth));
+                if (!my_turn && units.size() < WORK_PRODUCER_BUFFER)
+                    return;
+                my_turn = my_turn || wait_for_turn(producer, root);
+                if (!my_turn || !push_work_units(producer, units, board))
+                    board.done = true;
+            }, producer.depth);
+            board.done = false;
+        }
+        if (!my_turn && !wait_for_turn(producer, root))
+            break;
+        if (!push_work_units(producer, units, board))
+            break;
+        finish_turn(producer);
+    }
+}
+
+INLINE
+void start_work_producer(t_work_producer& producer) {
+    producer.start_time = std::chrono::steady_clock::now();
+    producer.running = static_cast<uint32_t>(producer.boards.size());
+    for (uint32_t idx = 0; idx < producer.boards.size(); ++idx) {
+        producer.threads.emplace_back([&producer, idx] {
+            work_producer_thread(producer, idx);
+            // The last producer to finish closes the queue
+            if (--producer.running == 0)
+                producer.queue->close();
+        });
+    }
+}
+
+INLINE
+void stop_work_producer(t_work_producer& producer) {
+    producer.queue->close();
+    {
+        std::lock_guard lock(producer.turn_mutex);
+        producer.stopped = true;
+        producer.turn.notify_all();
+    }
+    for (auto& thread : producer.threads) {
+        if (thread.joinable())
+            thread.join();
+    }
+    producer.threads.clear();
+}
+
+/// <summary>
+///  Number of units the producers will have generated in the end. Once they are done that is what they pushed,
+///  before that we scale what they pushed by how far the one pushing got in the prefix tree ( see
+///  live_stack_fraction ), the units reach the queue in prefix order so that is how far the whole tree got.
+/// </summary>
+INLINE
+std::optional<double> expected_work_units(const t_work_producer& producer) {
+    const auto pushed = static_cast<double>(producer.queue->pushed());
+    if (producer.queue->closed())
+        return pushed;
+    const auto fraction = producer.pushed_fraction.load(std::memory_order_acquire);
+    const auto resolution = producer.pushed_resolution.load(std::memory_order_relaxed);
+    if (fraction <= 0)
+        return std::nullopt;
+    return std::max(pushed, pushed / (fraction + resolution));
+}
+
 void generate_thread_data(
     const std::shared_ptr<t_PuzzleData>& puzzle_data,
     t_piece_matrix_vector* piece_vector_matrix, 
     std::shared_ptr<std::vector<t_thread_data>>& thread_data,
     std::shared_ptr<t_sync_data>& sync,
-    uint32_t min_combinations = 0) 
+    t_arena& arena,
+    t_work_producer& producer,
+    uint32_t split_depth = 0,
+    uint32_t min_combinations = 0,
+    uint32_t work_units_per_thread = 1) 
 {
     if (min_combinations == 0)
         min_combinations = 1;
-    
-    std::vector<t_piece_vector> starting_pieces;
-    // Generate all the starting pieces we can use
-    {
-        min_combinations = std::min(std::thread::hardware_concurrency() - 1, min_combinations);
-        std::vector<t_precalculated_piece> piece_stack;
+    min_combinations = std::min(available_worker_threads(), min_combinations);
 
-        uint32_t depth = 1;
-        uint32_t max_iterations = 20;
-        while(starting_pieces.size() < min_combinations && depth < puzzle_data->width && max_iterations-- > 0)
-        {
-            starting_pieces.clear();
-
-            auto board = create_board(puzzle_data, piece_vector_matrix);
-            // Start with the first corner piece set
-            const auto& corner_piece = piece_vector_matrix->pieces[CELL_TYPE::INNER]->at(0);
-            auto& cell = board->cells[0];
-            cell.identifier = corner_piece.identifier;
-            board->cells[cell.right_cell_offset].left_color = corner_piece.right;
-            board->cells[cell.bottom_cell_offset].top_color = corner_piece.bottom;
-            board->used_pieces[corner_piece.identifier.index] = true;
-            piece_stack.clear();
-            piece_stack.push_back(corner_piece);
-
-            backtrack_generator(*board, 1, piece_stack, [&starting_pieces](const auto& pieces) {
-                t_piece_vector pieces_vector;
-                std::copy(pieces.begin(), pieces.end(), std::back_inserter(pieces_vector));
-                starting_pieces.push_back(pieces_vector);
-            }, depth);
-            _aligned_free(board);
-            depth++;
-        }
+    // Past this depth the units would not fit in a work unit record
+    const auto max_depth = std::min(MAX_WORK_UNIT_DEPTH, puzzle_data->width * puzzle_data->height);
+    producer.pieceMatrixVector = piece_vector_matrix;
+    // As many producers as workers, they only run while the queue has room so they do not compete for long
+    for (uint32_t idx = 0; idx < min_combinations; ++idx) {
+        producer.boards.push_back(create_board(puzzle_data, piece_vector_matrix, arena));
     }
+    auto& board = *producer.boards.front();
+    // Roots from a compiled puzzle ( see PuzzleCache.h ) are used as they are
+    if (producer.roots.empty()) {
+        if (split_depth == 0) {
+            // Enough units for every thread, and for every lane of an interleaved thread
+            producer.depth = choose_split_depth(board, piece_vector_matrix, std::min(max_depth, puzzle_data->width - 1), min_combinations * work_units_per_thread);
+        }
+        else {
+            producer.depth = std::clamp<uint32_t>(split_depth, 1, max_depth);
+        }
 
-    auto work_queue = std::make_shared<ThreadSafeQueue<t_piece_vector>>();
-    for (const auto& pieces : starting_pieces) {
-        work_queue->push(pieces);
+        // The roots the producers share, shallow enough that listing them takes no time
+        const auto root_depth = choose_split_depth(board, piece_vector_matrix, producer.depth, min_combinations * WORK_PRODUCER_ROOTS);
+        std::vector<t_precalculated_piece> piece_stack;
+        place_first_corner(board, piece_vector_matrix, piece_stack);
+        backtrack_generator(board, 1, piece_stack, [&producer, &board, root_depth](const auto&) {
+            producer.roots.push_back(make_work_unit(board, root_depth));
+        }, root_depth);
+        board.done = false;
     }
 
+    producer.next_root = 0;
+    producer.pushing_root = 0;
+    producer.pushed_fraction = -1;
+    producer.pushed_resolution = 1;
+    producer.next_id = 0;
+    producer.stopped = false;
+    producer.first_unit_nanoseconds = 0;
+    producer.queue = std::make_shared<ThreadSafeQueue<t_work_unit>>(WORK_QUEUE_CAPACITY);
+
     for (uint32_t idx = 0; idx < min_combinations; ++idx) {
         thread_data->emplace_back();  // Construct in place
         auto& data = thread_data->back();
 
         data.puzzleData = puzzle_data;
         data.pieceMatrixVector = piece_vector_matrix;
-        data.workQueue = work_queue;
-        data.board = create_board(puzzle_data, piece_vector_matrix);
+        data.workQueue = producer.queue;
+        data.producer = &producer;
+        data.board = create_board(puzzle_data, piece_vector_matrix, arena);
         data.board->solution_callback = [](t_board& board) {};
+        data.backtrack_function = backtrack<t_diagnostic_policy>;
         data.sync = sync;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+
+#include "Common.h"
+
+// Number of entries sharing one bucket, a bucket is exactly 32 bytes so two of them share a cache line
+constexpr uint32_t TT_BUCKET_ENTRIES = 2;
+// The low bits of the stored data keep the remaining depth of the entry, the rest is the subtree count
+constexpr uint32_t TT_DEPTH_BITS = 8;
+constexpr uint64_t TT_DEPTH_MASK = (1ull << TT_DEPTH_BITS) - 1;
+constexpr uint64_t TT_MAX_COUNT = (1ull << (64 - TT_DEPTH_BITS)) - 1;
+
+/// <summary>
+///  One slot of the transposition table, it is written without any locks.
+///  The key is stored XOR-ed with the data ( the classic lockless hashing trick ), if two threads race on the
+///  same slot and we read the key of one and the data of the other the check fails and we treat it as a miss,
+///  we never return a count that belongs to a different subproblem.
+/// </summary>
+typedef struct {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+} t_tt_entry;
+
+typedef struct ALIGN(32) {
+    // Entry 0 keeps the deepest subtree we have seen, entry 1 is always replaced
+    t_tt_entry entries[TT_BUCKET_ENTRIES];
+} t_tt_bucket;
+
+typedef struct {
+    // Number of buckets - 1, the number of buckets is always a power of two
+    uint64_t mask;
+    // Total memory used by the buckets
+    uint64_t memory_size;
+    t_tt_bucket* buckets;
+} t_transposition_table;
+
+/// <summary>
+///  Create a table that fits in the memory budget, the bucket count is rounded down to a power of two
+/// </summary>
+/// <param name="memory_budget">Memory budget in bytes</param>
+/// <returns></returns>
+INLINE
+t_transposition_table* create_transposition_table(uint64_t memory_budget) {
+    uint64_t bucket_count = 1;
+    while (bucket_count * 2 * sizeof(t_tt_bucket) <= memory_budget) {
+        bucket_count *= 2;
+    }
+
+    auto table = new t_transposition_table();
+    table->mask = bucket_count - 1;
+    table->memory_size = bucket_count * sizeof(t_tt_bucket);
+    table->buckets = static_cast<t_tt_bucket*>(alloc_aligned(table->memory_size, 4096));
+    if (!table->buckets) {
+        delete table;
+        return nullptr; // Memory allocation failed
+    }
+    memset(static_cast<void*>(table->buckets), 0, table->memory_size);
+    return table;
+}
+
+void free_transposition_table(t_transposition_table* table) {
+    if (table == nullptr)
+        return;
+    free_aligned(table->buckets);
+    delete table;
+}
+
+/// <summary>
+///  Lookup a subtree count, returns true if the key was found
+/// </summary>
+FORCE_INLINE
+bool tt_probe(const t_transposition_table& table, uint64_t key, uint64_t& count) {
+    const auto& bucket = table.buckets[key & table.mask];
+    for (const auto& entry : bucket.entries) {
+        const auto data = entry.data.load(std::memory_order_relaxed);
+        const auto check = entry.check.load(std::memory_order_relaxed);
+        if ((check ^ data) == key) {
+            count = data >> TT_DEPTH_BITS;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///  Store a subtree count, the bigger the remaining depth the more expensive the subtree was to count
+/// </summary>
+FORCE_INLINE
+void tt_store(t_transposition_table& table, uint64_t key, uint64_t count, uint32_t remaining_depth) {
+    if (count > TT_MAX_COUNT) {
+        [[unlikely]]
+        return; // Does not fit, just recount it next time
+    }
+
+    auto& bucket = table.buckets[key & table.mask];
+    const auto depth = static_cast<uint64_t>(std::min<uint32_t>(remaining_depth, TT_DEPTH_MASK));
+    const auto data = (count << TT_DEPTH_BITS) | depth;
+
+    auto& preferred = bucket.entries[0];
+    const auto existing_data = preferred.data.load(std::memory_order_relaxed);
+    auto& target = (existing_data & TT_DEPTH_MASK) <= depth ? preferred : bucket.entries[1];
+    target.data.store(data, std::memory_order_relaxed);
+    target.check.store(key ^ data, std::memory_order_relaxed);
+}
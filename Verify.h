@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "CpuFeatures.h"
+#include "Options.h"
+#include "PuzzleCache.h"
+#include "PuzzleGenerator.h"
+#include "PuzzleLoader.h"
+
+/// <summary>
+///  Every solution a search reported, as hashes
+/// </summary>
+typedef struct {
+    std::mutex mutex;
+    std::vector<uint64_t> hashes;
+} t_solution_log;
+
+/// <summary>
+///  FNV-1a over the piece identifiers in cell order. The first corner always goes in the top left cell so the board
+///  orientation is fixed, a solution has exactly one hash no matter which engine found it.
+/// </summary>
+INLINE
+uint64_t hash_solution(const t_piece_identifier* identifiers, size_t stride, uint32_t count) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        const auto& identifier = *reinterpret_cast<const t_piece_identifier*>(reinterpret_cast<const uint8_t*>(identifiers) + idx * stride);
+        hash = (hash ^ identifier.index) * 0x100000001b3ull;
+        hash = (hash ^ identifier.rotation) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+INLINE
+void record_solution(t_solution_log& log, const t_board& board) {
+    const auto hash = hash_solution(board.identifiers, sizeof(t_piece_identifier), board.total_cells);
+    std::lock_guard lock(log.mutex);
+    log.hashes.push_back(hash);
+}
+
+// Solves a loaded puzzle, 'solve_puzzle' in main
+typedef int(*t_solve_puzzle_function)(
+    const std::shared_ptr<t_options>& options,
+    const std::shared_ptr<t_PuzzleData>& puzzle_data,
+    t_statistics_data& statistics,
+    t_solution_log* solution_log,
+    t_puzzle_cache* cache);
+
+typedef struct {
+    const char* name;
+    // The variant only counts, it never reports the solutions themselves
+    bool count_only;
+    // Part of --verify-quick
+    bool quick;
+    // The instruction set the variant needs
+    KERNEL_ISA::KERNEL_ISA isa;
+    void(*configure)(t_options& options);
+} t_verify_variant;
+
+// Every way we have to search a board, the first one is the reference the others are compared with.
+// New engines and pruning modes belong in this list.
+const t_verify_variant VERIFY_VARIANTS[] = {
+    { "scalar", false, true, KERNEL_ISA::SCALAR, [](t_options& options) { options.Isa = "scalar"; } },
+    { "scalar-prefetch", false, false, KERNEL_ISA::SCALAR, [](t_options& options) { options.Isa = "scalar"; options.Prefetch = true; } },
+    { "avx2", false, true, KERNEL_ISA::AVX2, [](t_options& options) { options.Isa = "avx2"; } },
+    { "avx2-prefetch", false, false, KERNEL_ISA::AVX2, [](t_options& options) { options.Isa = "avx2"; options.Prefetch = true; } },
+    { "avx512", false, true, KERNEL_ISA::AVX512, [](t_options& options) { options.Isa = "avx512"; } },
+    { "avx512-prefetch", false, false, KERNEL_ISA::AVX512, [](t_options& options) { options.Isa = "avx512"; options.Prefetch = true; } },
+    { "throughput", true, true, KERNEL_ISA::SCALAR, [](t_options& options) { options.Profile = "throughput"; } },
+    { "interleave-2", false, false, KERNEL_ISA::SCALAR, [](t_options& options) { options.Interleave = 2; } },
+    { "interleave-4", false, true, KERNEL_ISA::SCALAR, [](t_options& options) { options.Interleave = 4; } },
+    { "interleave-8", false, false, KERNEL_ISA::SCALAR, [](t_options& options) { options.Interleave = 8; } },
+    { "threads", false, false, KERNEL_ISA::SCALAR, [](t_options& options) { options.MaxThreads = available_worker_threads(); } },
+    { "memo", true, true, KERNEL_ISA::SCALAR, [](t_options& options) { options.Memo = true; options.MemoSizeMb = 16; } },
+    // Small units and a short interval so the workers pick up new orders while the puzzle is solved
+    { "adaptive-depth", false, true, KERNEL_ISA::SCALAR, [](t_options& options) { options.AdaptiveOrder = true; options.OrderScore = "depth"; options.OrderInterval = 0.001; options.SplitDepth = 3; } },
+    { "adaptive-yield", false, false, KERNEL_ISA::SCALAR, [](t_options& options) { options.AdaptiveOrder = true; options.OrderScore = "yield"; options.OrderInterval = 0.001; options.SplitDepth = 3; } },
+};
+
+typedef struct {
+    std::string name;
+    std::shared_ptr<t_PuzzleData> puzzle;
+    // Only for the generated puzzles, the solution we planted has to be found
+    std::optional<uint64_t> planted;
+} t_verify_puzzle;
+
+typedef struct {
+    int status;
+    uint64_t solutions;
+    std::vector<uint64_t> hashes;
+} t_verify_run;
+
+INLINE
+t_verify_run run_verify_variant(const std::shared_ptr<t_options>& options, const t_verify_puzzle& puzzle, t_solve_puzzle_function solve_puzzle) {
+    t_verify_run run = {};
+    t_statistics_data statistics;
+    t_solution_log solution_log;
+    const auto console = std::cout.rdbuf(nullptr);
+    run.status = solve_puzzle(options, puzzle.puzzle, statistics, &solution_log, nullptr);
+    std::cout.rdbuf(console);
+    run.solutions = statistics.total_solutions.load();
+    run.hashes = std::move(solution_log.hashes);
+    std::sort(run.hashes.begin(), run.hashes.end());
+    return run;
+}
+
+/// <summary>
+///  Differential check of the search variants. Every variant runs on the small puzzles in --verify-data and on random
+///  generated puzzles, all of them have to report the same number of solutions and, unless they only count, the same
+///  set of solutions as the reference. Returns RETURN_ERR on the first puzzle where they do not agree.
+/// </summary>
+INLINE
+int run_verify(const std::shared_ptr<t_options>& options, t_solve_puzzle_function solve_puzzle) {
+    const bool quick = options->VerifyQuick;
+    const auto cpu_features = detect_cpu_features();
+
+    std::vector<t_verify_puzzle> puzzles;
+    const char* data_puzzles[] = { "pieces_03x03.txt", "pieces_04x04.txt", "pieces_05x05.txt", "pieces_06x06.txt" };
+    for (const auto file : data_puzzles) {
+        if (quick && std::string(file) == "pieces_06x06.txt")
+            continue;
+        const auto path = std::filesystem::path(options->VerifyData) / file;
+        auto puzzle = Puzzle_Load(path.string());
+        if (!puzzle.has_value()) {
+            std::cout << e2::format("{:<24} missing, skipped\n", file);
+            continue;
+        }
+        puzzles.push_back({ .name = file, .puzzle = puzzle.value(), .planted = std::nullopt });
+    }
+
+    // Few colors give many solutions, which is what we want to compare, but the larger boards need more inner colors
+    // or the search never ends
+    const uint32_t random_puzzles = quick ? 4 : 16;
+    for (uint32_t idx = 0; idx < random_puzzles; ++idx) {
+        const uint32_t width = 3 + idx % 3;
+        const uint32_t height = 3 + (idx / 3) % 3;
+        const t_generator_settings settings = {
+            .width = width,
+            .height = height,
+            .border_colors = 1 + idx % 3,
+            .inner_colors = 2 + idx % 4 + (width - 3) * (height - 3) * 2,
+            .seed = static_cast<uint64_t>(options->VerifySeed) + idx
+        };
+        const auto generated = generate_puzzle(settings);
+        puzzles.push_back({
+            .name = e2::format("random {}x{} {}/{} #{}", settings.width, settings.height, settings.border_colors, settings.inner_colors, settings.seed),
+            .puzzle = generated.puzzle,
+            .planted = hash_solution(generated.solution.data(), sizeof(t_piece_identifier), settings.width * settings.height)
+        });
+    }
+
+    // Same search settings for every run, only the variant changes them
+    t_options base_options = *options;
+    base_options.Bench = false;
+    base_options.Verify = false;
+    base_options.FirstSolution = false;
+    base_options.Portfolio = false;
+    base_options.Restart = "none";
+    base_options.AdaptiveOrder = false;
+    base_options.OrderFile.clear();
+    base_options.DisplayOnConsole = false;
+    base_options.Bucas = false;
+    base_options.MaxNodesToPlace = -1;
+    base_options.MaxThreads = 1;
+    base_options.Memo = false;
+    base_options.Isa = "scalar";
+    base_options.Interleave = 1;
+    base_options.Prefetch = false;
+    base_options.HeatmapFile.clear();
+    base_options.Profile = "diagnostic";
+    base_options.Perf = false;
+
+    std::vector<const t_verify_variant*> variants;
+    for (const auto& variant : VERIFY_VARIANTS) {
+        if (quick && !variant.quick)
+            continue;
+        if (!is_kernel_isa_supported(cpu_features, variant.isa)) {
+            std::cout << e2::format("Variant {} needs {}, skipped\n", variant.name, kernel_isa_name(variant.isa));
+            continue;
+        }
+        variants.push_back(&variant);
+    }
+
+    int status = RETURN_OK;
+    for (const auto& puzzle : puzzles) {
+        std::vector<std::string> failures;
+        t_verify_run reference = {};
+        for (size_t idx = 0; idx < variants.size(); ++idx) {
+            const auto& variant = *variants[idx];
+            auto variant_options = std::make_shared<t_options>(base_options);
+            variant.configure(*variant_options);
+
+            auto run = run_verify_variant(variant_options, puzzle, solve_puzzle);
+            if (run.status != RETURN_OK) {
+                failures.push_back(e2::format("{} failed to run", variant.name));
+                continue;
+            }
+            if (idx == 0) {
+                reference = std::move(run);
+                if (reference.hashes.size() != reference.solutions)
+                    failures.push_back(e2::format("{} counted {} solutions but reported {}", variant.name, reference.solutions, reference.hashes.size()));
+                if (std::adjacent_find(reference.hashes.begin(), reference.hashes.end()) != reference.hashes.end())
+                    failures.push_back(e2::format("{} reported the same solution twice", variant.name));
+                if (puzzle.planted.has_value() && !std::binary_search(reference.hashes.begin(), reference.hashes.end(), puzzle.planted.value()))
+                    failures.push_back(e2::format("{} did not find the planted solution", variant.name));
+                continue;
+            }
+
+            if (run.solutions != reference.solutions)
+                failures.push_back(e2::format("{} counted {} solutions", variant.name, run.solutions));
+            else if (!variant.count_only && run.hashes != reference.hashes)
+                failures.push_back(e2::format("{} found different solutions", variant.name));
+        }
+
+        if (failures.empty()) {
+            std::cout << e2::format("{:<24} {:>8} solutions, {} variants agree\n", puzzle.name, reference.solutions, variants.size());
+        }
+        else {
+            std::cout << e2::format("{:<24} {:>8} solutions ( reference {} ), FAILED\n", puzzle.name, reference.solutions, variants.front()->name);
+            for (const auto& failure : failures) {
+                std::cout << e2::format("    {}\n", failure);
+            }
+            status = RETURN_ERR;
+        }
+    }
+
+    std::cout << e2::format("Verified {} puzzles with {} variants: {}\n", puzzles.size(), variants.size(), status == RETURN_OK ? "ok" : "FAILED");
+    return status;
+}
@@ -1,29 +1,51 @@
 ﻿#include <filesystem>
-#include <format>
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 #include <execution>
 #include <thread>
 
 #include "Backtracker.h"
+#include "Bench.h"
 #include "Board.h"
 #include "Common.h"
+#include "CpuFeatures.h"
 #include "Options.h"
+#include "PuzzleCache.h"
+#include "PuzzleGenerator.h"
 #include "PuzzleLoader.h"
 #include "PieceMatrix.h"
 #include "PrintUtils.h"
+#include "RunControl.h"
 #include "ThreadingCommon.h"
 #include "ThreadWorker.h"
+#include "Verify.h"
 
 typedef struct {
     std::shared_ptr<t_options> options;
     std::shared_ptr<t_PuzzleData> puzzleData;
     std::shared_ptr<t_sync_data> sync;
+    // Index of the worker owning the board
+    uint32_t worker_index;
+    // Set when the verification harness wants every solution
+    t_solution_log* solution_log;
 } t_board_user_data;
 
 void handle_board_solution(t_board& board) {
     auto user_data = static_cast<t_board_user_data*>(board.user_data);
+    // Only the first solution is reported, then stop the other workers right away. The search may already be
+    // stopping for another reason ( time limit, node limit, signal ), a solution found on the way out still counts.
+    if (user_data->options->FirstSolution) {
+        uint32_t no_worker = 0;
+        if (!user_data->sync->first_solution_worker.compare_exchange_strong(no_worker, user_data->worker_index + 1))
+            return;
+        request_stop("first solution");
+    }
+    if (user_data->solution_log != nullptr) {
+        record_solution(*user_data->solution_log, board);
+    }
+
     std::lock_guard lock(user_data->sync->print_mutex);
     if (user_data->options->Bucas) {
         copy_cells(board);
@@ -36,27 +58,117 @@ void handle_board_solution(t_board& board) {
     }
 }
 
-int main(const int argc, const char* argv[])
+/// <summary>
+///  Hardware counters normalized per node, the ratios tell if the search is bound by branches or by memory
+/// </summary>
+void print_perf_report(const t_statistics_data& total_statistics, int perf_error, bool nodes_counted) {
+    const auto& perf = total_statistics.perf;
+    if (perf.valid == 0) {
+        std::cout << e2::format("Hardware counters are not available: {}\n", std::strerror(perf_error));
+        return;
+    }
+    if (perf_error != 0) {
+        std::cout << e2::format("Some hardware counters are not available: {}\n", std::strerror(perf_error));
+    }
+
+    const auto placed = static_cast<double>(std::max<uint64_t>(1, total_statistics.total_nodes_placed));
+    const auto checked = static_cast<double>(std::max<uint64_t>(1, total_statistics.total_nodes_checked));
+    for (uint8_t event = 0; event < PERF_EVENT::MAX; ++event) {
+        if (!is_perf_event_valid(perf, static_cast<PERF_EVENT::PERF_EVENT>(event)))
+            continue;
+        if (!nodes_counted) {
+            std::cout << e2::format("{:<14} {:>10} | per node n/a\n",
+                perf_event_name(static_cast<PERF_EVENT::PERF_EVENT>(event)),
+                format_number_human_readable(perf.values[event]));
+            continue;
+        }
+        std::cout << e2::format("{:<14} {:>10} | {:8.3f} per placed node | {:8.3f} per checked node\n",
+            perf_event_name(static_cast<PERF_EVENT::PERF_EVENT>(event)),
+            format_number_human_readable(perf.values[event]),
+            static_cast<double>(perf.values[event]) / placed,
+            static_cast<double>(perf.values[event]) / checked);
+    }
+    if (is_perf_event_valid(perf, PERF_EVENT::INSTRUCTIONS) && is_perf_event_valid(perf, PERF_EVENT::CYCLES) && perf.values[PERF_EVENT::CYCLES] > 0) {
+        std::cout << e2::format("Instructions per cycle: {:.2f}\n",
+            static_cast<double>(perf.values[PERF_EVENT::INSTRUCTIONS]) / static_cast<double>(perf.values[PERF_EVENT::CYCLES]));
+    }
+}
+
+/// <summary>
+///  Solve a loaded puzzle with the options, the totals are left in 'total_statistics' for the caller
+/// </summary>
+int solve_puzzle(
+    const std::shared_ptr<t_options>& optionsData,
+    const std::shared_ptr<t_PuzzleData>& puzzleData,
+    t_statistics_data& total_statistics,
+    t_solution_log* solution_log,
+    t_puzzle_cache* cache)
 {
-    //////////////////////////////////////////////////////////////////
-    // Check that we got everything we need on the command line
-    cxxopts::Options options(argv[0]);
-    auto options_ptr = load_options(options, argc, argv);
-    if (!options_ptr.has_value())
-    {
-        std::cout << options.help();  // NOLINT(clang-diagnostic-format-security)
+    run_control_reset();
+    run_control_set_node_limit(optionsData->MaxNodesToPlace);
+    if (optionsData->Memo && optionsData->FirstSolution) {
+        std::cerr << "The transposition table can only be used to count all the solutions\n";
         return RETURN_ERR;
     }
-
-    //////////////////////////////////////////////////////////////////
-    // Load the puzzle data if possible
-    auto optionsData = options_ptr.value();
-    auto puzzleDataPtr = Puzzle_Load(optionsData->PuzzleFile);
-    if (!puzzleDataPtr.has_value()) {
-        std::cerr << "Failed to load puzzle from file: \n" << optionsData->PuzzleFile;
+    if (optionsData->Memo && optionsData->Interleave > 1) {
+        std::cerr << "The transposition table can not be used with interleaved work units\n";
+        return RETURN_ERR;
+    }
+    if (optionsData->Portfolio && (!optionsData->FirstSolution || optionsData->Memo || optionsData->Interleave > 1)) {
+        std::cerr << "The portfolio only looks for the first solution ( --first ), with the plain depth first search\n";
+        return RETURN_ERR;
+    }
+    const auto restart_schedule = parse_restart_schedule(optionsData->Restart);
+    if (!restart_schedule.has_value()) {
+        std::cerr << e2::format("Unknown restart schedule: {}\n", optionsData->Restart);
+        return RETURN_ERR;
+    }
+    if (restart_schedule.value() != RESTART_SCHEDULE::NONE) {
+        if (!optionsData->FirstSolution || optionsData->Memo || optionsData->Interleave > 1) {
+            std::cerr << "The restarts only look for the first solution ( --first ), with the plain depth first search\n";
+            return RETURN_ERR;
+        }
+        if (optionsData->RestartNodes <= 0 || optionsData->RestartFactor <= 1.0) {
+            std::cerr << "The restarts need a positive --restart-nodes and a --restart-factor above 1\n";
+            return RETURN_ERR;
+        }
+    }
+    // Both give every worker the whole puzzle and a candidate order of its own
+    const bool whole_puzzle_workers = optionsData->Portfolio || restart_schedule.value() != RESTART_SCHEDULE::NONE;
+    const bool adaptive_order = optionsData->AdaptiveOrder || !optionsData->OrderFile.empty();
+    const auto order_score = parse_candidate_score(optionsData->OrderScore);
+    if (!order_score.has_value()) {
+        std::cerr << e2::format("Unknown candidate score: {}\n", optionsData->OrderScore);
+        return RETURN_ERR;
+    }
+    if (adaptive_order && (optionsData->Memo || optionsData->Interleave > 1 || whole_puzzle_workers || optionsData->Profile != search_profile_name(SEARCH_PROFILE::DIAGNOSTIC))) {
+        std::cerr << "The adaptive order is only learned by the plain depth first search of the diagnostic profile, without --portfolio or --restart\n";
+        return RETURN_ERR;
+    }
+    if (!optionsData->HeatmapFile.empty() && (optionsData->Memo || optionsData->Interleave > 1)) {
+        std::cerr << "The heatmap is only recorded by the plain depth first search\n";
+        return RETURN_ERR;
+    }
+    const auto search_profile = parse_search_profile(optionsData->Profile);
+    if (!search_profile.has_value()) {
+        std::cerr << e2::format("Unknown search profile: {}\n", optionsData->Profile);
+        return RETURN_ERR;
+    }
+    if (search_profile.value() == SEARCH_PROFILE::THROUGHPUT) {
+        // Nothing in the throughput build can show or count what these need
+        if (optionsData->FirstSolution || optionsData->DisplayOnConsole || optionsData->Bucas || optionsData->MaxNodesToPlace > 0 || !optionsData->HeatmapFile.empty()) {
+            std::cerr << "The throughput profile only counts solutions, it can not be used with --first, --display, --bucas, --max-nodes or --heatmap\n";
+            return RETURN_ERR;
+        }
+        if (optionsData->Memo || optionsData->Interleave > 1) {
+            std::cerr << "The throughput profile only applies to the plain depth first search\n";
+            return RETURN_ERR;
+        }
+    }
+    if (optionsData->MetricsPort < 0 || optionsData->MetricsPort > UINT16_MAX) {
+        std::cerr << e2::format("The metrics port has to be between 1 and {}, 0 turns the metrics off\n", UINT16_MAX);
         return RETURN_ERR;
     }
-    auto puzzleData = puzzleDataPtr.value();
 
     //////////////////////////////////////////////////////////////////
     // Create the piece vector matrix, this is one of the major optimisation
@@ -64,85 +176,349 @@ int main(const int argc, const char* argv[])
     //  For each CELL TYPE it creates a matrix of vector pointers, the matrix is of size (max_color + 1) * (max_color + 1)
     //  a cell in the matrix is going from 'left'*'top' to find the right vector that contains pieces for that particular
     //  left and top color combination
-    auto piece_vector_matrix = distribute_pieces(puzzleData);
+    // It lives in the arena with the boards and the search stacks, everything the search touches is in one place
+    const auto setup_start = std::chrono::high_resolution_clock::now();
+    auto arena = create_arena(ARENA_BLOCK_SIZE, optionsData->HugePages);
+    if (arena == nullptr) {
+        std::cerr << "Failed to allocate the solver arena\n";
+        return RETURN_ERR;
+    }
+    // A compiled puzzle already has the candidate lists, only the slots are filled in
+    const bool cache_hit = cache != nullptr && cache->header != nullptr;
+    auto piece_vector_matrix = cache_hit ? puzzle_cache_matrix(*cache, *arena) : distribute_pieces(puzzleData, *arena);
+    if (piece_vector_matrix == nullptr) {
+        std::cerr << "Failed to allocate the piece matrix\n";
+        free_arena(arena);
+        return RETURN_ERR;
+    }
 
     ////////////////////////////////////////////////////////////////////
     // Create the threads and start the work
-    const auto max_threads = static_cast<int64_t>(std::thread::hardware_concurrency() - 1);
+    const auto max_threads = static_cast<int64_t>(available_worker_threads());
     const auto actual_max_threads = std::max<int64_t>(1, std::min(optionsData->MaxThreads, max_threads));
-    std::cout << std::format("Using up to {} thread(s)\n", actual_max_threads);
+    std::cout << e2::format("Using up to {} thread(s)\n", actual_max_threads);
+
+    //////////////////////////////////////////////////////////////////
+    // Pick the search kernels for this CPU, unless we were asked for a specific one
+    const auto cpu_features = detect_cpu_features();
+    auto kernel_isa = best_kernel_isa(cpu_features);
+    if (optionsData->Isa != "auto") {
+        const auto requested_isa = parse_kernel_isa(optionsData->Isa);
+        if (!requested_isa.has_value()) {
+            std::cerr << e2::format("Unknown instruction set: {}\n", optionsData->Isa);
+            free_arena(arena);
+            return RETURN_ERR;
+        }
+        if (!is_kernel_isa_supported(cpu_features, requested_isa.value())) {
+            std::cerr << e2::format("The CPU does not support the {} kernels\n", optionsData->Isa);
+            free_arena(arena);
+            return RETURN_ERR;
+        }
+        kernel_isa = requested_isa.value();
+    }
+    auto backtrack_function = get_backtrack_function(kernel_isa, optionsData->Prefetch, search_profile.value());
+    if (restart_schedule.value() != RESTART_SCHEDULE::NONE)
+        backtrack_function = get_backtrack_function<t_restart_policy>(kernel_isa, optionsData->Prefetch);
+    else if (adaptive_order)
+        backtrack_function = get_backtrack_function<t_adaptive_policy>(kernel_isa, optionsData->Prefetch);
+    std::cout << e2::format("Using the {} kernels with the {} profile\n", kernel_isa_name(kernel_isa), search_profile_name(search_profile.value()));
+
+    // Subtree counts are shared by all the threads
+    t_transposition_table* transposition_table = nullptr;
+    if (optionsData->Memo) {
+        transposition_table = create_transposition_table(static_cast<uint64_t>(std::max<int64_t>(1, optionsData->MemoSizeMb)) * 1024 * 1024);
+        if (transposition_table == nullptr) {
+            std::cerr << "Failed to allocate the transposition table\n";
+            free_arena(arena);
+            return RETURN_ERR;
+        }
+        std::cout << e2::format("Allocated transposition table with {} bytes\n", transposition_table->memory_size);
+    }
+
+    t_metrics_server* metrics_server = nullptr;
+    if (optionsData->MetricsPort > 0) {
+        metrics_server = create_metrics_server(static_cast<uint16_t>(optionsData->MetricsPort));
+        if (metrics_server == nullptr) {
+            std::cerr << e2::format("Failed to serve the metrics on port {}\n", optionsData->MetricsPort);
+            free_transposition_table(transposition_table);
+            free_arena(arena);
+            return RETURN_ERR;
+        }
+        std::cout << e2::format("Serving metrics on http://127.0.0.1:{}/metrics\n", optionsData->MetricsPort);
+    }
 
     // We need a sync object to coordinate printing and stopping
     auto sync = std::make_shared<t_sync_data>();
     auto thread_data = std::make_shared<std::vector<t_thread_data>>();
+    // The work units are generated while the workers search
+    t_work_producer producer;
+    if (cache_hit) {
+        producer.depth = cache->header->split_depth;
+        producer.roots = puzzle_cache_roots(*cache);
+        std::cout << e2::format("Mapped the compiled puzzle {}\n", cache->file_name);
+    }
     // Generate the needed thread data
     generate_thread_data(
         puzzleData,
         piece_vector_matrix,
         thread_data,
         sync,
-        std::min(max_threads, optionsData->MaxThreads)
+        *arena,
+        producer,
+        static_cast<uint32_t>(std::clamp<int64_t>(optionsData->SplitDepth, 0, MAX_WORK_UNIT_DEPTH)),
+        std::min(max_threads, optionsData->MaxThreads),
+        static_cast<uint32_t>(std::clamp<int64_t>(optionsData->Interleave, 1, MAX_INTERLEAVED_LANES))
     );
-    std::cout << std::format("Created data for {} thread(s)\n", actual_max_threads);
+    total_statistics.setup_time = std::chrono::high_resolution_clock::now() - setup_start;
+    if (cache != nullptr && !cache_hit) {
+        // Not part of the setup time, the next run is the one that gains from it
+        if (write_puzzle_cache(*cache, *puzzleData, *piece_vector_matrix, producer.depth, producer.roots))
+            std::cout << e2::format("Wrote the compiled puzzle {}\n", cache->file_name);
+        else
+            std::cerr << e2::format("Failed to write the compiled puzzle {}\n", cache->file_name);
+    }
+    std::cout << e2::format("Created data for {} thread(s), work units fill {} cell(s), {} root(s) for the producers\n", actual_max_threads, producer.depth, producer.roots.size());
+
+    if (whole_puzzle_workers) {
+        for (auto& data : *thread_data) {
+            // The first portfolio worker keeps the regular order, so the portfolio is never worse than a single
+            // thread. The restarts reorder before every run, the first one included.
+            const auto idx = &data - thread_data->data();
+            data.portfolio_seed = idx == 0 && optionsData->Portfolio ? 0 : static_cast<uint64_t>(optionsData->PortfolioSeed) + idx;
+            data.portfolio_matrix = create_shuffled_piece_matrix(*piece_vector_matrix, *arena, data.portfolio_seed);
+            if (data.portfolio_matrix == nullptr) {
+                std::cerr << "Failed to allocate the candidate orders of the workers\n";
+                free_transposition_table(transposition_table);
+                free_metrics_server(metrics_server);
+                free_arena(arena);
+                return RETURN_ERR;
+            }
+        }
+    }
+
+    // The workers count for the adaptive order into their own counters, the orders are built from all of them
+    t_candidate_ordering* ordering = nullptr;
+    if (adaptive_order) {
+        ordering = create_candidate_ordering(*piece_vector_matrix, order_score.value(), *arena);
+        for (auto& data : *thread_data) {
+            const auto statistics = ordering != nullptr ? add_candidate_statistics(*ordering) : nullptr;
+            if (statistics == nullptr) {
+                std::cerr << "Failed to allocate the candidate statistics\n";
+                free_candidate_ordering(ordering);
+                free_transposition_table(transposition_table);
+                free_metrics_server(metrics_server);
+                free_arena(arena);
+                return RETURN_ERR;
+            }
+            data.ordering = ordering;
+            data.board->candidate_statistics = statistics;
+        }
+        if (!optionsData->OrderFile.empty() && std::filesystem::exists(optionsData->OrderFile)) {
+            if (load_candidate_order(*ordering, optionsData->OrderFile, *arena))
+                std::cout << e2::format("Loaded the candidate statistics from {}\n", optionsData->OrderFile);
+            else
+                std::cerr << e2::format("The candidate statistics in {} do not fit this puzzle, starting over\n", optionsData->OrderFile);
+        }
+        // The first units already search in the loaded order
+        for (auto& data : *thread_data) {
+            data.board->candidate_statistics->order = ordering->current.load();
+            set_board_matrix(*data.board, data.board->candidate_statistics->order->matrix);
+        }
+    }
 
     // Now we can start the threads
-    t_statistics_data total_statistics;
     {
         for(auto& data : *thread_data) {
             data.board->user_data = new t_board_user_data{
                 .options = optionsData,
                 .puzzleData = puzzleData,
-                .sync = sync
+                .sync = sync,
+                .worker_index = static_cast<uint32_t>(&data - thread_data->data()),
+                .solution_log = solution_log
             };
             data.board->solution_callback = handle_board_solution;
+            data.backtrack_function = backtrack_function;
+            if (transposition_table != nullptr) {
+                data.memo = create_memo_context(transposition_table, *data.board);
+            }
+            if (optionsData->Interleave > 1) {
+                data.interleaved = create_interleaved_search(puzzleData, piece_vector_matrix, *data.board, static_cast<uint32_t>(optionsData->Interleave), *arena);
+            }
+            if (!optionsData->HeatmapFile.empty()) {
+                data.board->cell_statistics = create_cell_statistics(data.board->total_cells);
+            }
+            if (optionsData->Perf) {
+                data.perf = create_perf_counters();
+            }
+            if (restart_schedule.value() != RESTART_SCHEDULE::NONE) {
+                data.restart = create_restart_state(
+                    restart_schedule.value(),
+                    static_cast<uint64_t>(optionsData->RestartNodes),
+                    optionsData->RestartFactor,
+                    optionsData->RestartLearn,
+                    data.portfolio_seed,
+                    static_cast<uint32_t>(std::size(data.board->used_pieces)));
+            }
+            // The estimate needs the placed nodes of the plain depth first search over the work units
+            if (optionsData->EtaProbes > 0 && transposition_table == nullptr && data.interleaved == nullptr && !whole_puzzle_workers && search_profile.value() == SEARCH_PROFILE::DIAGNOSTIC) {
+                data.estimate = create_unit_estimate(static_cast<uint32_t>(optionsData->EtaProbes), &data - thread_data->data() + 1);
+            }
+        }
+
+        // From here on a signal can reach the searches
+        for (auto& data : *thread_data) {
+            if (!run_control_add_board(data.board))
+                std::cerr << "Too many threads, the extra ones only stop between work units\n";
         }
 
+        print_arena_map(&std::cout, *arena);
+
         std::cout << "Starting reporting thread\n";
         std::jthread reporter([&]() {
-            reporting_thread(thread_data, total_statistics, sync, optionsData);
+            reporting_thread(thread_data, total_statistics, sync, optionsData, metrics_server);
         });
+        std::jthread orderer;
+        if (ordering != nullptr) {
+            orderer = std::jthread([&]() {
+                candidate_order_thread(*ordering, *arena, sync, optionsData->OrderInterval);
+            });
+        }
 
         std::cout << "Starting worker threads\n";
         // Now start the worker threads
         total_statistics.start_time = std::chrono::high_resolution_clock::now();
         total_statistics.start_clock_cycles = __rdtsc();
+        // The portfolio workers search the whole puzzle, they take no work units
+        if (whole_puzzle_workers)
+            producer.queue->close();
+        else
+            start_work_producer(producer);
         {
             std::vector<std::jthread> workers;
             for (auto& data : *thread_data) {
-                workers.emplace_back(worker_thread, std::ref(data));
+                workers.emplace_back(run_worker_thread, std::ref(data));
             }
         }
+        total_statistics.stop_latency = run_control_stop_latency(std::chrono::steady_clock::now());
+        stop_work_producer(producer);
+        total_statistics.first_unit_time = std::chrono::nanoseconds(producer.first_unit_nanoseconds.load());
         total_statistics.end_clock_cycles = __rdtsc();
         total_statistics.end_time = std::chrono::high_resolution_clock::now();
         sync->done = true;
     }
 
-    std::cout << std::format("\nWork completed. Used {} thread(s)\n", thread_data->size());
+    // Every worker counted its own thread
+    total_statistics.perf = {};
+    int perf_error = 0;
+    if (optionsData->Perf) {
+        for (size_t idx = 0; idx < thread_data->size(); ++idx) {
+            const auto& counters = *thread_data->at(idx).perf;
+            merge_perf_values(total_statistics.perf, counters.values, idx == 0);
+            if (perf_error == 0)
+                perf_error = counters.error;
+        }
+    }
+
+    std::cout << e2::format("\nWork completed. Used {} thread(s)\n", thread_data->size());
+    if (run_control_stopping())
+        std::cout << e2::format("Search stopped early: {}. The workers stopped {} after the request\n",
+            get_run_control().stop_reason.load(),
+            format_duration(total_statistics.stop_latency));
+    if (restart_schedule.value() != RESTART_SCHEDULE::NONE) {
+        uint64_t runs = 0;
+        for (const auto& data : *thread_data) {
+            runs += data.restart->runs;
+        }
+        std::cout << e2::format("Restarts: {} run(s) over all the workers with the {} schedule\n", runs, restart_schedule_name(restart_schedule.value()));
+        if (sync->first_solution_worker > 0) {
+            const auto& restart = *thread_data->at(sync->first_solution_worker - 1).restart;
+            std::cout << e2::format("Worker {} found the first solution in its run {}, with a budget of {} placed nodes\n",
+                sync->first_solution_worker - 1,
+                restart.runs,
+                format_number_human_readable(restart.budget));
+        }
+    }
+    else if (ordering != nullptr) {
+        uint64_t placements = 0;
+        for (const auto& counts : merge_candidate_counts(*ordering)) {
+            placements += counts.placements;
+        }
+        std::cout << e2::format("Candidate order: {} reorder(s) by {}, learned from {} placements\n",
+            ordering->reorders,
+            candidate_score_name(ordering->score),
+            format_number_human_readable(placements));
+        if (!optionsData->OrderFile.empty()) {
+            if (save_candidate_order(*ordering, optionsData->OrderFile))
+                std::cout << e2::format("Saved the candidate statistics to {}\n", optionsData->OrderFile);
+            else
+                std::cerr << e2::format("Failed to save the candidate statistics to {}\n", optionsData->OrderFile);
+        }
+    }
+    else if (optionsData->Portfolio && sync->first_solution_worker > 0) {
+        const auto& winner = thread_data->at(sync->first_solution_worker - 1);
+        std::cout << e2::format("Portfolio: worker {} ({}) found the first solution\n",
+            sync->first_solution_worker - 1,
+            winner.portfolio_seed == 0 ? std::string("regular order") : e2::format("seed {}", winner.portfolio_seed));
+    }
 
-    std::cout << std::format("Total solutions: {}. Total placed nodes: {}. Total checked nodes: {}\n", 
-        total_statistics.total_solutions.load(),
-        format_number_human_readable(total_statistics.total_nodes_placed),
-        format_number_human_readable(total_statistics.total_nodes_checked));
+    // The throughput build does not count the nodes, zeros would read like a measurement
+    const bool nodes_counted = search_profile.value() != SEARCH_PROFILE::THROUGHPUT;
+    if (nodes_counted) {
+        std::cout << e2::format("Total solutions: {}. Total placed nodes: {}. Total checked nodes: {}\n", 
+            total_statistics.total_solutions.load(),
+            format_number_human_readable(total_statistics.total_nodes_placed),
+            format_number_human_readable(total_statistics.total_nodes_checked));
+    }
+    else {
+        std::cout << e2::format("Total solutions: {}. Total placed nodes: n/a. Total checked nodes: n/a\n", 
+            total_statistics.total_solutions.load());
+    }
 
     // Display some timing information
-    std::cout << std::format("Total time: {}. Total clock cycles: {}\n",
+    std::cout << e2::format("Total time: {}. Total clock cycles: {}\n",
         format_duration(total_statistics.end_time - total_statistics.start_time),
         format_number_human_readable(total_statistics.end_clock_cycles - total_statistics.start_clock_cycles));
 
+    std::cout << e2::format("Startup: loading {}. Setup {}. First work unit after {}\n",
+        format_duration(total_statistics.load_time),
+        format_duration(total_statistics.setup_time),
+        format_duration(total_statistics.first_unit_time));
+
     // How many nodes per second did we place?
     const auto total_seconds = std::chrono::duration_cast<std::chrono::seconds>(total_statistics.end_time - total_statistics.start_time).count();
-    if (total_seconds > 0) {
-        std::cout << std::format("Average nodes placed per second: {}. Average nodes checked per second: {}\n",
+    if (!nodes_counted) {
+        std::cout << "Average nodes placed per second: n/a. Average nodes checked per second: n/a\n";
+        std::cout << "Average clock cycles per placed node: n/a. Average clock cycles per checked node: n/a\n";
+    }
+    else if (total_seconds > 0) {
+        std::cout << e2::format("Average nodes placed per second: {}. Average nodes checked per second: {}\n",
             format_number_human_readable(total_statistics.total_nodes_placed / total_seconds),
             format_number_human_readable(total_statistics.total_nodes_checked / total_seconds));
     }
     // How many clock cycles per placed node and checked node?
     if (total_statistics.total_nodes_placed > 0) {
-        std::cout << std::format("Average clock cycles per placed node: {:.2}. Average clock cycles per checked node: {:.2}\n",
+        std::cout << e2::format("Average clock cycles per placed node: {:.2}. Average clock cycles per checked node: {:.2}\n",
             static_cast<double>(total_statistics.end_clock_cycles - total_statistics.start_clock_cycles) / total_statistics.total_nodes_placed,
             static_cast<double>(total_statistics.end_clock_cycles - total_statistics.start_clock_cycles) / total_statistics.total_nodes_checked);
     }
 
+    if (optionsData->Perf) {
+        print_perf_report(total_statistics, perf_error, nodes_counted);
+    }
+
+    if (transposition_table != nullptr) {
+        uint64_t probes = 0, hits = 0, stores = 0;
+        for (const auto& data : *thread_data) {
+            probes += data.memo->probes;
+            hits += data.memo->hits;
+            stores += data.memo->stores;
+        }
+        std::cout << e2::format("Transposition table probes: {}. Hits: {} ({:.2f}%). Stores: {}\n",
+            format_number_human_readable(probes),
+            format_number_human_readable(hits),
+            probes > 0 ? 100.0 * static_cast<double>(hits) / static_cast<double>(probes) : 0.0,
+            format_number_human_readable(stores));
+    }
 
     // Cleanup
     for(auto& data : *thread_data) {
@@ -151,19 +527,82 @@ int main(const int argc, const char* argv[])
             delete user_data;
 
         data.board->user_data = nullptr;
-        if (data.board != nullptr)
-            _aligned_free(data.board);
+        delete data.memo;
+        data.memo = nullptr;
+        free_interleaved_search(data.interleaved);
+        data.interleaved = nullptr;
+        delete data.perf;
+        delete data.estimate;
+        data.perf = nullptr;
+        free_restart_state(data.restart);
+        data.restart = nullptr;
+        if (data.board != nullptr) {
+            free_cell_statistics(data.board->cell_statistics);
+            data.board->cell_statistics = nullptr;
+        }
     }
 
-    // We need to free the piece vectors
-    for (uint32_t i = 0; i < static_cast<uint32_t>(CELL_TYPE::MAX) * piece_vector_matrix->cell_type_offset; ++i) {
-        // Free each vector if it was allocated
-        if (piece_vector_matrix->pieces[i] != nullptr) {
-            delete piece_vector_matrix->pieces[i];
-            piece_vector_matrix->pieces[i] = nullptr;
+    free_candidate_ordering(ordering);
+    // The piece matrix, the boards and the search stacks
+    free_arena(arena);
+    free_transposition_table(transposition_table);
+    free_metrics_server(metrics_server);
+
+    return RETURN_OK;
+}
+
+/// <summary>
+///  Load the puzzle from the options and solve it
+/// </summary>
+int solve(const std::shared_ptr<t_options>& optionsData, t_statistics_data& total_statistics)
+{
+    //////////////////////////////////////////////////////////////////
+    // Load the puzzle data if possible
+    const auto load_start = std::chrono::high_resolution_clock::now();
+    // With a cache directory the compiled puzzle replaces the puzzle file when it is there
+    t_puzzle_cache* cache = nullptr;
+    if (!optionsData->PuzzleCache.empty()) {
+        const auto threads = static_cast<uint32_t>(std::clamp<int64_t>(optionsData->MaxThreads, 1, available_worker_threads()));
+        cache = open_puzzle_cache(optionsData->PuzzleCache, optionsData->PuzzleFile, *optionsData, threads);
+        if (cache == nullptr) {
+            std::cerr << "Failed to load puzzle from file: \n" << optionsData->PuzzleFile;
+            return RETURN_ERR;
         }
     }
-    _aligned_free(piece_vector_matrix);
+    auto puzzleDataPtr = cache != nullptr && cache->header != nullptr ? t_puzzle_data_ptr(puzzle_cache_puzzle(*cache)) : Puzzle_Load(optionsData->PuzzleFile);
+    total_statistics.load_time = std::chrono::high_resolution_clock::now() - load_start;
+    if (!puzzleDataPtr.has_value()) {
+        std::cerr << "Failed to load puzzle from file: \n" << optionsData->PuzzleFile;
+        free_puzzle_cache(cache);
+        return RETURN_ERR;
+    }
+    const auto status = solve_puzzle(optionsData, puzzleDataPtr.value(), total_statistics, nullptr, cache);
+    // The candidate lists of a compiled puzzle were read from the mapping until the end
+    free_puzzle_cache(cache);
+    return status;
+}
+
+int main(const int argc, const char* argv[])
+{
+    //////////////////////////////////////////////////////////////////
+    // Check that we got everything we need on the command line
+    cxxopts::Options options(argv[0]);
+    auto options_ptr = load_options(options, argc, argv);
+    if (!options_ptr.has_value())
+    {
+        std::cout << options.help();  // NOLINT(clang-diagnostic-format-security)
+        return RETURN_ERR;
+    }
 
-    return RETURN_OK;
+    auto optionsData = options_ptr.value();
+    install_run_control_signals();
+    if (optionsData->Bench)
+        return run_benchmark(optionsData, solve);
+    if (optionsData->Verify)
+        return run_verify(optionsData, solve_puzzle);
+    if (!optionsData->GenerateFile.empty())
+        return run_generate(optionsData);
+
+    t_statistics_data total_statistics;
+    return solve(optionsData, total_statistics);
 }